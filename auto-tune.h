@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace Pepega {
+
+    //==============================//
+    // Per-phase pool tuning        //
+    //==============================//
+
+    // How a parallel phase runs on the pool: how many workers take part and how many rows each grabs at once
+    struct pool_config {
+        int workers = 1;
+        int grain = 1;
+    };
+
+    // Picks a pool_config for one phase from the time of its calls. Every candidate is tried for a few calls
+    // first, then the fewest workers within `tolerance` of the fastest candidate win, so workers that don't
+    // pay off stay parked. Once settled, a moving average of the call time is watched, and a lasting drift
+    // away from the measured time (the fluid moved, the box got busier) starts the search over
+    class phase_tuner {
+        static constexpr int trial_calls = 5;
+        static constexpr double tolerance = 1.05;
+        static constexpr double drift = 1.3;
+        static constexpr int drift_calls = 50;
+        static constexpr double smoothing = 0.05;
+        // Shifts below this many seconds are scheduler noise for a phase, not a new workload
+        static constexpr double min_shift = 20e-6;
+
+        std::vector<pool_config> candidates;
+        std::vector<double> best;
+        std::vector<double> total;
+        size_t current = 0;
+        int samples = 0;
+        bool settled = false;
+        pool_config chosen{};
+        double baseline = 0;
+        double average = 0;
+        int drifting = 0;
+        int searches = 0;
+
+        void restart() {
+            best.assign(candidates.size(), std::numeric_limits<double>::infinity());
+            total.assign(candidates.size(), 0);
+            current = 0;
+            samples = 0;
+            settled = false;
+            drifting = 0;
+            ++searches;
+        }
+
+        void settle() {
+            double fastest = *std::min_element(best.begin(), best.end());
+            size_t pick = 0;
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                if (best[i] > fastest * tolerance) {
+                    continue;
+                }
+                if (best[pick] > fastest * tolerance || candidates[i].workers < candidates[pick].workers ||
+                    (candidates[i].workers == candidates[pick].workers && best[i] < best[pick])) {
+                    pick = i;
+                }
+            }
+            chosen = candidates[pick];
+            // Candidates are compared by their best call, drift is measured against the typical one
+            baseline = average = total[pick] / trial_calls;
+            settled = true;
+        }
+
+    public:
+        phase_tuner() = default;
+
+        // Candidates are 1, 2, 4, ... and all of `workers` workers, each with a grain of 1, 4 and 16 rows
+        explicit phase_tuner(int workers) {
+            for (int count = 1;; count = std::min(count * 2, workers)) {
+                for (int grain: {1, 4, 16}) {
+                    candidates.push_back({count, grain});
+                }
+                if (count == workers) {
+                    break;
+                }
+            }
+            restart();
+        }
+
+        pool_config config() const {
+            return settled ? chosen : candidates[current];
+        }
+
+        bool is_settled() const {
+            return settled;
+        }
+
+        // Number of searches so far, the first one included
+        int search_count() const {
+            return searches;
+        }
+
+        // Seconds the last call run with config() took
+        void report(double seconds) {
+            if (!settled) {
+                best[current] = std::min(best[current], seconds);
+                total[current] += seconds;
+                if (++samples == trial_calls) {
+                    samples = 0;
+                    if (++current == candidates.size()) {
+                        settle();
+                    }
+                }
+                return;
+            }
+            average += (seconds - average) * smoothing;
+            bool off = (average > baseline * drift || average * drift < baseline) &&
+                       std::abs(average - baseline) > min_shift;
+            drifting = off ? drifting + 1 : 0;
+            if (drifting == drift_calls) {
+                restart();
+            }
+        }
+    };
+}
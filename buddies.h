@@ -1,63 +1,220 @@
+#pragma once
+
+#include <algorithm>
 #include <atomic>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <memory>
 #include <thread>
 #include "missions.h"
+#include "placement.h"
+#include "trace.h"
+
+// Spins on `a` for up to `limit` rounds before parking on the futex: the phases of a small grid end
+// sooner than a sleep/wake round trip
+inline void spin_then_wait(const std::atomic<int> &a, int old, int limit) {
+    for (int i = 0; i < limit; ++i) {
+        if (a.load(std::memory_order_acquire) != old) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+    a.wait(old);
+}
 
 class BuddiesForeman {
 private:
+    // `begin` holds the generation of the current set() in its high bits and the number of workers
+    // taking part in it in the low ones, so a worker reads both at once
+    static constexpr int active_bits = 12;
+    static constexpr int active_mask = (1 << active_bits) - 1;
+
+    // What the workers run: chunks [from, to) of [0, size) are handed to run(body, from, to).
+    // parallel_for points body at the caller's functor, set() at a mission list
+    struct job {
+        void (*run)(void *body, int from, int to) = nullptr;
+        void *body = nullptr;
+        int size = 0;
+        // What the workers' events are called in a trace
+        const char *name = "missions";
+    };
+
     int workers = 0;
+    int active = 0;
+    int grain = 1;
+    job current{};
+    int spin = 2000;
     bool is_active = false;
+    bool banded = false;
     std::atomic<bool> stop_flag = false;
     std::vector<std::thread> threads;
+    Pepega::worker_trace *trace = nullptr;
+    // With a trace: when the last worker of the current job finished, the start of the barrier's tail
+    std::atomic<uint64_t> last_finish = 0;
 
 public:
-    std::atomic<std::vector<std::unique_ptr<Mission>> *> atomic_tasks = nullptr;
     std::atomic<int> index = 0;
     std::atomic<int> begin = 0;
     std::atomic<int> end = 0;
+    // Workers with id >= roster are parked until it grows
+    std::atomic<int> roster = 0;
 
     BuddiesForeman() = default;
 
-    void init(int n);
+    void init(int n, const std::vector<int> &cpus = {});
+    int size() const { return workers; }
+    void set_banded(bool value) { banded = value; }
+    // Spin rounds before a worker or wait() parks, 0 parks at once. Takes effect for threads started by init()
+    void set_spin(int rounds) { spin = std::max(rounds, 0); }
+    // Records the workers' timelines into `t` (sized for this pool) from the next job on, nullptr stops.
+    // Set it between jobs only
+    void set_trace(Pepega::worker_trace *t) {
+        if (t && t->workers() != workers) {
+            throw std::invalid_argument("Trace is sized for another pool");
+        }
+        trace = t;
+    }
     void set(std::vector<std::unique_ptr<Mission>> *);
     void wait();
+
+    // Calls body(from, to) for chunks of `chunk` indices covering [0, n) on the first `count` workers
+    // (all of them by default) and returns when all are done. No allocation and no virtual call: the body
+    // is compiled together with its loop and reached through one function pointer per chunk. `name` labels
+    // the workers' events in a trace
+    template<typename F>
+    void parallel_for(int n, int chunk, F &&body, int count = -1, const char *name = "parallel_for") {
+        using functor = std::remove_reference_t<F>;
+        job range;
+        range.run = [](void *f, int from, int to) {
+            (*static_cast<functor *>(f))(from, to);
+        };
+        range.body = const_cast<void *>(static_cast<const void *>(&body));
+        range.size = n;
+        range.name = name;
+        start(range, count < 0 ? workers : count, chunk);
+        wait();
+    }
     void stop_all();
 
 private:
-    static void buddy_realisation(BuddiesForeman &);
+    void start(const job &, int count, int chunk);
+    static void buddy_realisation(BuddiesForeman &, int);
 };
 
-inline void BuddiesForeman::buddy_realisation(BuddiesForeman &handler) {
-    handler.begin.wait(0);
-    int last_start = handler.begin;
-    while (!handler.stop_flag.load()) {
-        auto missions = handler.atomic_tasks.load();
-        int personal_index = handler.index.fetch_add(1);
-        if (personal_index >= missions->size()) {
-            handler.end.fetch_add(1);
-            handler.end.notify_one();
-            handler.begin.wait(last_start);
-            last_start = handler.begin;
+inline void BuddiesForeman::buddy_realisation(BuddiesForeman &handler, int id) {
+    int seen = 0;
+    // End of the worker's last job in a trace and that trace: the start of its wait for the next job
+    uint64_t idle = 0;
+    Pepega::worker_trace *idle_trace = nullptr;
+    while (true) {
+        // Parked workers sleep on the roster, so the phases they don't take part in don't wake them up
+        int roster;
+        while (id >= (roster = handler.roster.load()) && !handler.stop_flag.load()) {
+            handler.roster.wait(roster);
+        }
+        spin_then_wait(handler.begin, seen, handler.spin);
+        seen = handler.begin;
+        if (handler.stop_flag.load()) {
+            break;
+        }
+        if (id >= (seen & active_mask)) {
             continue;
         }
-        missions->at(personal_index)->do_this();
+
+        auto work = handler.current;
+        // Read only once begin announced a job, set_trace happens before that
+        auto *trace = handler.trace;
+        uint64_t busy = 0;
+        if (trace) {
+            busy = trace->now();
+            // A worker whose last job was before the trace was attached has no idle start
+            trace->record(id + 1, "wait", idle_trace == trace ? idle : busy, busy);
+        }
+        int size = work.size;
+        int chunks = 0;
+        if (handler.banded) {
+            // Static bands: a worker always gets the same slice of rows, i.e. the memory it touched first
+            int from = size * id / handler.workers, to = size * (id + 1) / handler.workers;
+            if (from < to) {
+                work.run(work.body, from, to);
+                ++chunks;
+            }
+        } else {
+            int chunk = handler.grain;
+            for (int from; (from = handler.index.fetch_add(chunk)) < size;) {
+                work.run(work.body, from, std::min(from + chunk, size));
+                ++chunks;
+            }
+        }
+        if (trace) {
+            uint64_t done = trace->now();
+            trace->record(id + 1, work.name, busy, done, chunks);
+            idle = done;
+            uint64_t latest = handler.last_finish.load(std::memory_order_relaxed);
+            while (latest < done && !handler.last_finish.compare_exchange_weak(latest, done,
+                                                                               std::memory_order_relaxed)) {
+            }
+        }
+        idle_trace = trace;
+        handler.end.fetch_add(1);
+        handler.end.notify_one();
     }
 }
 
-inline void BuddiesForeman::init(int n) {
+inline void BuddiesForeman::init(int n, const std::vector<int> &cpus) {
+    if (n > active_mask) {
+        throw std::invalid_argument("Too many threads");
+    }
     workers = n;
+    active = n;
+    // Spinning only pays off when the workers and the thread waiting for them all have a core of their own
+    if (n + 1 > int(std::thread::hardware_concurrency())) {
+        spin = 0;
+    }
+    roster.store(n);
     for (int i = 0; i < workers; i++) {
-        threads.emplace_back(buddy_realisation, std::ref(*this));
+        threads.emplace_back(buddy_realisation, std::ref(*this), i);
+        if (!cpus.empty()) {
+            Pepega::pin_thread(threads.back(), cpus[i % cpus.size()]);
+        }
     }
 }
 
 inline void BuddiesForeman::set(std::vector<std::unique_ptr<Mission>> *missions) {
+    job list;
+    list.run = [](void *m, int from, int to) {
+        auto &tasks = *static_cast<std::vector<std::unique_ptr<Mission>> *>(m);
+        for (int i = from; i < to; ++i) {
+            tasks[i]->do_this();
+        }
+    };
+    list.body = missions;
+    list.size = int(missions->size());
+    start(list, workers, 1);
+}
+
+inline void BuddiesForeman::start(const job &work, int count, int chunk) {
+    if (banded && count != workers) {
+        throw std::logic_error("Banded workers can't be parked");
+    }
     is_active = true;
+    active = std::clamp(count, 1, workers);
+    grain = std::max(chunk, 1);
     index.store(0);
     end.store(0);
-    atomic_tasks.store(missions);
-    begin.fetch_add(1);
+    last_finish.store(0, std::memory_order_relaxed);
+    current = work;
+    if (roster.load() != active) {
+        roster.store(active);
+        roster.notify_all();
+    }
+    // Generations wrap around, they are only compared for equality
+    begin.store(int(((unsigned(begin.load()) >> active_bits) + 1) << active_bits | unsigned(active)));
     begin.notify_all();
 }
 
@@ -66,15 +223,23 @@ inline void BuddiesForeman::wait() {
         return;
     }
     int last;
-    while ((last = end) != workers) {
-        end.wait(last);
+    while ((last = end) != active) {
+        spin_then_wait(end, last, spin);
     }
     is_active = false;
+    if (trace) {
+        // From the last worker finishing to the caller running again: the wake-up cost of the barrier
+        uint64_t back = trace->now();
+        trace->record(0, "barrier", std::min(last_finish.load(std::memory_order_relaxed), back), back);
+    }
 }
 
 
 inline void BuddiesForeman::stop_all() {
     stop_flag.store(true);
+    roster.store(workers + 1);
+    roster.notify_all();
+    begin.fetch_add(1 << active_bits);
     begin.notify_all();
     for (auto &thread : threads) {
         if (thread.joinable()) {
@@ -0,0 +1,49 @@
+#pragma once
+
+//==============================//
+// Kernel multi-versioning      //
+//==============================//
+
+// With FLUID_CPU_DISPATCH the hot kernels are compiled once per instruction set, and the loader picks
+// the best one for the CPU when the program starts (GCC/Clang target_clones, x86-64 ELF only)
+#ifndef FLUID_CPU_DISPATCH
+#define FLUID_CPU_DISPATCH 1
+#endif
+
+#if FLUID_CPU_DISPATCH && defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__)
+#define FLUID_MULTIVERSIONED 1
+#define FLUID_KERNEL __attribute__((target_clones("avx512f", "avx2", "sse4.2", "default")))
+#else
+#define FLUID_MULTIVERSIONED 0
+#define FLUID_KERNEL
+#endif
+
+// For the functions a kernel calls per row: a call from a clone would land in the one default-ISA copy,
+// inlined they are compiled into every variant along with the kernel
+#if defined(__GNUC__)
+#define FLUID_KERNEL_INLINE [[gnu::always_inline]] inline
+#else
+#define FLUID_KERNEL_INLINE inline
+#endif
+
+namespace Pepega {
+
+    // Name of the kernel variant the loader picks on this CPU: the clones above in the same priority order
+    inline const char *kernel_target() {
+#if FLUID_MULTIVERSIONED
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return "avx512f";
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return "avx2";
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return "sse4.2";
+        }
+        return "default";
+#else
+        return "default (no dispatch)";
+#endif
+    }
+}
@@ -11,7 +11,9 @@ namespace Pepega {
     template<typename T>
     T g() { return 0.1; };
 
-    std::mt19937 rnd(1337);
+    // One generator per thread: the simulators a thread steps share it, simulators stepped on different threads
+    // (the jobs of fluid-daemon) don't race on it
+    thread_local std::mt19937 rnd(1337);
 
     template<typename T>
     T random01() {
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#include "fixed.h"
+
+namespace Pepega {
+
+    //==============================//
+    // Lane traits                  //
+    //==============================//
+
+    // Raw lane representation of a simulation type: Fixed is kept as its integer, floating types as they are
+    template<typename T>
+    struct batch_traits {
+        using lane_t = T;
+        using fixed_t = T;
+        static constexpr bool is_fixed = false;
+        static constexpr int k = 0;
+
+        static lane_t raw(T x) { return x; }
+
+        static T cook(lane_t x) { return x; }
+    };
+
+    template<int N, int K, bool isFast>
+    struct batch_traits<Fixed<N, K, isFast>> {
+        using lane_t = typename Fixed<N, K, isFast>::value_t;
+        using fixed_t = Fixed<N, K, isFast>;
+        static constexpr bool is_fixed = true;
+        static constexpr int k = K;
+
+        static lane_t raw(Fixed<N, K, isFast> x) { return x.v; }
+
+        static Fixed<N, K, isFast> cook(lane_t x) { return Fixed<N, K, isFast>::from_raw(x); }
+    };
+
+    // Compact storage is widened into the lanes of the type it stands for, and narrowed again on store
+    template<typename Wide>
+    struct batch_traits<packed_fixed<Wide>> {
+        using lane_t = typename batch_traits<Wide>::lane_t;
+        using fixed_t = Wide;
+        static constexpr bool is_fixed = true;
+        static constexpr int k = batch_traits<Wide>::k;
+
+        static lane_t raw(packed_fixed<Wide> x) { return x.v; }
+
+        static packed_fixed<Wide> cook(lane_t x) { return Wide::from_raw(x); }
+    };
+
+    //==============================//
+    // Packed batch of values       //
+    //==============================//
+
+    // A fixed number of lanes of one simulation type. Every operation is a plain loop over the lanes,
+    // which the compiler turns into vector instructions, so kernels can work on whole rows at once. Fixed
+    // lanes round, widen and saturate exactly like the scalar operators
+    template<typename T, int L = 8>
+    struct Batch {
+        using traits = batch_traits<T>;
+        using lane_t = typename traits::lane_t;
+        using fixed_t = typename traits::fixed_t;
+        // Integer masks (all ones / zero per lane) blend without branches
+        using mask_t = std::array<std::conditional_t<sizeof(lane_t) == 8, int64_t, int32_t>, L>;
+
+        static constexpr int lanes = L;
+
+        std::array<lane_t, L> v{};
+
+        static Batch broadcast(T x) {
+            Batch ret;
+            ret.v.fill(traits::raw(x));
+            return ret;
+        }
+
+        // Loads L values starting at `src`, `stride` elements apart (stride 4 reads one component of a VectorField row)
+        static Batch load(const T *src, int stride = 1) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                ret.v[i] = traits::raw(src[i * stride]);
+            }
+            return ret;
+        }
+
+        void store(T *dst, int stride = 1) const {
+            for (int i = 0; i < L; ++i) {
+                dst[i * stride] = traits::cook(v[i]);
+            }
+        }
+
+        // Row helpers for Array: lanes y .. y + L - 1 of row x
+        template<typename A>
+        static Batch load_row(A &arr, int x, int y) {
+            return load(&arr[x][y]);
+        }
+
+        template<typename A>
+        void store_row(A &arr, int x, int y) const {
+            store(&arr[x][y]);
+        }
+
+        friend Batch operator+(const Batch &a, const Batch &b) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                if constexpr (traits::is_fixed && FIXED_SATURATING) {
+                    ret.v[i] = (fixed_t::from_raw(a.v[i]) + fixed_t::from_raw(b.v[i])).v;
+                } else {
+                    ret.v[i] = a.v[i] + b.v[i];
+                }
+            }
+            return ret;
+        }
+
+        friend Batch operator-(const Batch &a, const Batch &b) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                if constexpr (traits::is_fixed && FIXED_SATURATING) {
+                    ret.v[i] = (fixed_t::from_raw(a.v[i]) - fixed_t::from_raw(b.v[i])).v;
+                } else {
+                    ret.v[i] = a.v[i] - b.v[i];
+                }
+            }
+            return ret;
+        }
+
+        friend Batch operator*(const Batch &a, const Batch &b) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                if constexpr (traits::is_fixed) {
+                    ret.v[i] = (fixed_t::from_raw(a.v[i]) * fixed_t::from_raw(b.v[i])).v;
+                } else {
+                    ret.v[i] = a.v[i] * b.v[i];
+                }
+            }
+            return ret;
+        }
+
+        // Raw value of 1 / d, to replace a division by d in a loop with mul_reciprocal
+        static lane_t reciprocal(T d) {
+            if constexpr (traits::is_fixed) {
+                using product_t = typename fixed_t::product_t;
+                return lane_t((product_t(1) << (2 * traits::k)) / traits::raw(d));
+            } else {
+                return lane_t(1) / d;
+            }
+        }
+
+        // a * (1 / d), an approximation of a / d: for Fixed the reciprocal is truncated to K fractional bits
+        friend Batch mul_reciprocal(const Batch &a, lane_t r) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                if constexpr (traits::is_fixed) {
+                    ret.v[i] = fixed_t::narrow((static_cast<typename fixed_t::product_t>(a.v[i]) * r) >> traits::k).v;
+                } else {
+                    ret.v[i] = a.v[i] * r;
+                }
+            }
+            return ret;
+        }
+
+        friend mask_t operator<(const Batch &a, const Batch &b) {
+            mask_t m;
+            for (int i = 0; i < L; ++i) {
+                m[i] = -(a.v[i] < b.v[i]);
+            }
+            return m;
+        }
+
+        friend mask_t operator<=(const Batch &a, const Batch &b) {
+            mask_t m;
+            for (int i = 0; i < L; ++i) {
+                m[i] = -(a.v[i] <= b.v[i]);
+            }
+            return m;
+        }
+
+        friend mask_t operator>(const Batch &a, const Batch &b) { return b < a; }
+
+        friend mask_t operator>=(const Batch &a, const Batch &b) { return b <= a; }
+
+        friend mask_t operator==(const Batch &a, const Batch &b) {
+            mask_t m;
+            for (int i = 0; i < L; ++i) {
+                m[i] = -(a.v[i] == b.v[i]);
+            }
+            return m;
+        }
+
+        // Lane i of the result is a.v[i] where m[i] is set and b.v[i] otherwise
+        friend Batch select(const mask_t &m, const Batch &a, const Batch &b) {
+            Batch ret;
+            for (int i = 0; i < L; ++i) {
+                ret.v[i] = m[i] ? a.v[i] : b.v[i];
+            }
+            return ret;
+        }
+    };
+}
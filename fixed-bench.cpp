@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "crutches.h"
+#include "fixed.h"
+#include "flags-parser.h"
+#include "type-codes.h"
+
+#ifndef DTYPES
+#error "Types are not definded"
+#endif
+
+//==============================//
+// Value type microbenchmarks   //
+//==============================//
+
+// Cost of the operations the kernels are made of, for every type of DTYPES: arithmetic, comparison, fabs,
+// random01 and the conversions between the types (v_type(force / rho) is a division and a conversion).
+// Latency is the time of one operation in a chain where each one needs the result of the previous one,
+// throughput the time per operation with 8 independent chains interleaved. Best of --repeats runs
+
+namespace {
+    constexpr int chains = 8;
+
+    // Makes the compiler forget what it knows about x without emitting an instruction: the value stays in a
+    // register but can't be folded, hoisted out of the loop or vectorised across iterations. Goes through a
+    // copy, an array element given to asm directly keeps the whole array in memory
+    template<typename T>
+    inline void opaque(T &x) {
+        T y = x;
+        if constexpr (std::is_floating_point_v<T>) {
+#if defined(__x86_64__) || defined(__i386__)
+            asm volatile("" : "+x"(y));
+#elif defined(__aarch64__)
+            asm volatile("" : "+w"(y));
+#else
+            asm volatile("" : "+m"(y));
+#endif
+        } else {
+            asm volatile("" : "+r"(y.v));
+        }
+        x = y;
+    }
+
+    struct timing {
+        double latency;
+        double throughput;
+    };
+
+    template<typename F>
+    double best_ns(int repeats, long long operations, F &&run) {
+        double best = 1e300;
+        for (int r = 0; r < repeats; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            best = std::min(best, ns / double(operations));
+        }
+        return best;
+    }
+
+    // Calls f(x) for every element with constant indices, so the chains live in registers rather than in
+    // the array's memory
+    template<typename T, typename F>
+    inline void for_chains(std::array<T, chains> &x, F &&f) {
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            (f(std::get<I>(x)), ...);
+        }(std::make_index_sequence<chains>());
+    }
+
+    // step(x) is one operation from T to T
+    template<typename T, typename Step>
+    timing measure(int iterations, int repeats, T start, Step step) {
+        timing result{};
+        result.latency = best_ns(repeats, iterations, [&] {
+            T x = start;
+            for (int i = 0; i < iterations; ++i) {
+                x = step(x);
+                opaque(x);
+            }
+            opaque(x);
+        });
+        result.throughput = best_ns(repeats, (long long) iterations * chains, [&] {
+            std::array<T, chains> x;
+            x.fill(start);
+            for (int i = 0; i < iterations; ++i) {
+                for_chains(x, [&](T &value) {
+                    value = step(value);
+                    opaque(value);
+                });
+            }
+            for_chains(x, [](T &value) { opaque(value); });
+        });
+        return result;
+    }
+
+    // From -> To: latency of the round trip From -> To -> From, throughput of the one-way conversion
+    template<typename From, typename To>
+    timing measure_conversion(int iterations, int repeats, From start) {
+        timing result{};
+        result.latency = best_ns(repeats, iterations, [&] {
+            From x = start;
+            for (int i = 0; i < iterations; ++i) {
+                To y = To(x);
+                opaque(y);
+                x = From(y);
+                opaque(x);
+            }
+        });
+        result.throughput = best_ns(repeats, (long long) iterations * chains, [&] {
+            std::array<From, chains> x;
+            x.fill(start);
+            for (int i = 0; i < iterations; ++i) {
+                for_chains(x, [](From &value) {
+                    opaque(value);
+                    To y = To(value);
+                    opaque(y);
+                });
+            }
+        });
+        return result;
+    }
+
+    void print(const std::string &type, const std::string &operation, timing t) {
+        std::printf("%-20s %-28s %10.3f %10.3f\n", type.c_str(), operation.c_str(), t.latency, t.throughput);
+    }
+
+    constexpr auto type_codes = std::array{DTYPES};
+
+    template<int code>
+    void bench_type(int iterations, int repeats) {
+        using T = Pepega::get_type<code>;
+        auto name = type_name(code);
+        // Operands the chains keep their values with: nothing overflows however long the run
+        T zero = 0.0, one = 1.0, big = 1000.0;
+        opaque(zero);
+        opaque(one);
+        opaque(big);
+        T start = 1.5;
+
+        print(name, "+", measure(iterations, repeats, start, [=](T x) { return x + zero; }));
+        print(name, "*", measure(iterations, repeats, start, [=](T x) { return x * one; }));
+        print(name, "/", measure(iterations, repeats, start, [=](T x) { return x / one; }));
+        print(name, "<", measure(iterations, repeats, start, [=](T x) { return x < big ? x : big; }));
+        print(name, "fabs", measure(iterations, repeats, start, [=](T x) {
+            using std::fabs;
+            return T(fabs(x));
+        }));
+        // One generator: the chains share its state, so both numbers are its latency
+        print(name, "random01", measure(iterations, repeats, start, [=](T) { return Pepega::random01<T>(); }));
+        [&]<size_t... I>(std::index_sequence<I...>) {
+            ((print(name, "-> " + type_name(type_codes[I]),
+                    measure_conversion<T, Pepega::get_type<type_codes[I]>>(iterations, repeats, start))), ...);
+        }(std::make_index_sequence<type_codes.size()>());
+        // Literals and the loaders go through double, measured here when the rows of DOUBLE don't cover it
+        if constexpr (std::find(type_codes.begin(), type_codes.end(), DOUBLE) == type_codes.end()) {
+            print(name, "-> DOUBLE", measure_conversion<T, double>(iterations, repeats, start));
+            print(name, "<- DOUBLE", measure_conversion<double, T>(iterations, repeats, 1.5));
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    parser options_parser(argc, argv);
+    int iterations = std::stoi(options_parser.get_option("--iterations", "4000000"));
+    int repeats = std::stoi(options_parser.get_option("--repeats", "5"));
+    if (iterations < 1 || repeats < 1) {
+        throw std::invalid_argument("--iterations and --repeats must be positive");
+    }
+
+    std::printf("%-20s %-28s %10s %10s\n", "type", "operation", "lat, ns", "thr, ns");
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        (bench_type<type_codes[I]>(iterations, repeats), ...);
+    }(std::make_index_sequence<type_codes.size()>());
+    return 0;
+}
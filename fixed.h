@@ -4,6 +4,7 @@
 #include <array>
 #include <algorithm>
 #include <cassert>
+#include <concepts>
 #include <cstdint>
 #include <iostream>
 #include <limits>
@@ -44,6 +45,27 @@ namespace Pepega {
                 std::conditional_t<N == 64, int64_t, void>>>>;
     };
 
+    //==============================//
+    // Wide arithmetic backend      //
+    //==============================//
+
+    // With FIXED_SATURATING results that don't fit the N bits of a Fixed are clamped to its range instead of
+    // wrapping around (see CMakeLists.txt)
+#ifndef FIXED_SATURATING
+#define FIXED_SATURATING 0
+#endif
+
+    // Integer the products and the shifted dividends of raw values of type V are formed in: 64 bits are
+    // enough below 64-bit values, those need 128 (where the compiler has no 128-bit integer, 64-bit values
+    // wrap as they always did)
+#if defined(__SIZEOF_INT128__)
+    template <typename V>
+    using fixed_product_t = std::conditional_t<(sizeof(V) < sizeof(int64_t)), int64_t, __int128>;
+#else
+    template <typename V>
+    using fixed_product_t = int64_t;
+#endif
+
     //==============================//
     // Fixed-point arithmetic       //
     //==============================//
@@ -52,16 +74,53 @@ namespace Pepega {
     template <int N, int K, bool isFast = false>
     struct Fixed {
         using value_t = real_type_t<N, isFast>;
+        using product_t = fixed_product_t<value_t>;
 
         constexpr static value_t scale = 1ll << K;
         value_t v = 0;
 
         static const int k = K;
 
+        // Range of the raw value, N bits even where value_t is wider
+        constexpr static int64_t raw_max = N >= 64 ? std::numeric_limits<int64_t>::max() : (int64_t(1) << (N - 1)) - 1;
+        constexpr static int64_t raw_min = -raw_max - 1;
+
+        // Result of an operation, formed in a wider integer, as a Fixed: wraps around, or is clamped to the
+        // range with FIXED_SATURATING
+        template <typename W>
+        static constexpr Fixed narrow(W x) {
+            if constexpr (FIXED_SATURATING) {
+                x = std::clamp(x, W(raw_min), W(raw_max));
+            }
+            return from_raw(value_t(x));
+        }
+
+        // Same for a scaled floating-point value, NaN becomes 0
+        static constexpr value_t saturate(double x) {
+            if (!(x == x)) {
+                return 0;
+            }
+            if (x >= double(raw_max)) {
+                return value_t(raw_max);
+            }
+            if (x <= double(raw_min)) {
+                return value_t(raw_min);
+            }
+            return value_t(x);
+        }
+
         // Constructor for converting between Fixed types with different parameters
         template <int otherN, int otherK, bool otherIsFast>
         constexpr Fixed(const Fixed<otherN, otherK, otherIsFast>& other) {
-            if constexpr (otherK > K) {
+            if constexpr (FIXED_SATURATING) {
+                using wide_t = std::conditional_t<(sizeof(product_t) > sizeof(typename Fixed<otherN, otherK, otherIsFast>::product_t)),
+                        product_t, typename Fixed<otherN, otherK, otherIsFast>::product_t>;
+                if constexpr (otherK > K) {
+                    v = narrow(wide_t(other.v) >> (otherK - K)).v;
+                } else {
+                    v = narrow(wide_t(other.v) << (K - otherK)).v;
+                }
+            } else if constexpr (otherK > K) {
                 v = other.v >> (otherK - K);
             } else {
                 v = other.v << (K - otherK);
@@ -69,16 +128,16 @@ namespace Pepega {
         }
 
         // Constructors for initializing Fixed from various types
-        constexpr Fixed(int64_t v) : v(v << K) {}
+        constexpr Fixed(int64_t v) : v(FIXED_SATURATING ? narrow(product_t(v) << K).v : value_t(v << K)) {}
 
-        constexpr Fixed(float f) : v(f * Fixed::scale) {}
+        constexpr Fixed(float f) : v(FIXED_SATURATING ? saturate(double(f) * Fixed::scale) : value_t(f * Fixed::scale)) {}
 
-        constexpr Fixed(double f) : v(f * Fixed::scale) {}
+        constexpr Fixed(double f) : v(FIXED_SATURATING ? saturate(f * Fixed::scale) : value_t(f * Fixed::scale)) {}
 
         constexpr Fixed() : v(0) {}
 
         // Factory method to create Fixed from raw integer representation
-        static constexpr Fixed from_raw(int x) {
+        static constexpr Fixed from_raw(value_t x) {
             Fixed ret{};
             ret.v = x;
             return ret;
@@ -94,19 +153,41 @@ namespace Pepega {
         explicit constexpr operator double() const { return double(v) / (1LL << K); }
         // Arithmetic operators for Fixed-point arithmetic
         friend Fixed operator+(Fixed a, Fixed b) {
+            if constexpr (FIXED_SATURATING) {
+                return narrow(product_t(a.v) + b.v);
+            }
             return Fixed::from_raw(a.v + b.v);
         }
 
         friend Fixed operator-(Fixed a, Fixed b) {
+            if constexpr (FIXED_SATURATING) {
+                return narrow(product_t(a.v) - b.v);
+            }
             return Fixed::from_raw(a.v - b.v);
         }
 
+        // Products are rounded towards minus infinity (arithmetic shift) at every width
         friend Fixed operator*(Fixed a, Fixed b) {
-            return Fixed::from_raw((static_cast<int64_t>(a.v) * b.v) >> K);
+            return narrow((static_cast<product_t>(a.v) * b.v) >> K);
         }
 
+        // Quotients are truncated towards zero at every width. A 64-bit value shifted by K only needs the slow
+        // 128-bit division when it doesn't fit 64 bits any more, i.e. for values beyond 2^(63 - 2K)
         friend Fixed operator/(Fixed a, Fixed b) {
-            return Fixed::from_raw((static_cast<int64_t>(a.v) << K) / b.v);
+            if constexpr (sizeof(product_t) > sizeof(int64_t)) {
+                constexpr int64_t fits = std::numeric_limits<int64_t>::max() >> K;
+                if (-fits <= a.v && a.v <= fits) {
+                    return narrow((int64_t(a.v) << K) / int64_t(b.v));
+                }
+            }
+            return narrow((static_cast<product_t>(a.v) << K) / b.v);
+        }
+
+        // Division by an integer (the cell's dirs in the pressure phases): the same quotient as dividing by
+        // Fixed(b), without the shifts
+        template <std::integral I>
+        friend Fixed operator/(Fixed a, I b) {
+            return narrow(int64_t(a.v) / int64_t(b));
         }
 
         // Compound assignment operators
@@ -118,7 +199,7 @@ namespace Pepega {
 
         friend Fixed& operator/=(Fixed& a, Fixed b) { return a = a / b; }
 
-        friend Fixed operator-(Fixed x) { return Fixed::from_raw(-x.v); }
+        friend Fixed operator-(Fixed x) { return narrow(-static_cast<product_t>(x.v)); }
 
         friend Fixed fabs(Fixed x) {
             if (x.v < 0) {
@@ -133,4 +214,87 @@ namespace Pepega {
         }
     };
 
+    //==============================//
+    // Storage types                //
+    //==============================//
+
+#ifndef FLUID_COMPACT_STORAGE
+#define FLUID_COMPACT_STORAGE 1
+#endif
+
+    // A FAST_FIXED value at rest. The fast integer computes in registers, but on most platforms it is wider than
+    // the N bits the type promises (int_fast32_t is 64-bit on Linux/glibc), so the grids keep the exact-width
+    // integer instead: reads widen it back to the fast type and writes narrow it
+    template<typename Wide>
+    struct packed_fixed;
+
+    template<int N, int K>
+    struct packed_fixed<Fixed<N, K, true>> {
+        using wide_t = Fixed<N, K, true>;
+        using value_t = real_type_t<N, false>;
+
+        value_t v = 0;
+
+        constexpr packed_fixed() = default;
+
+        constexpr packed_fixed(wide_t x) : v(value_t(x.v)) {}
+
+        constexpr operator wide_t() const { return wide_t::from_raw(v); }
+
+        explicit constexpr operator float() const { return float(wide_t(*this)); }
+
+        explicit constexpr operator double() const { return double(wide_t(*this)); }
+
+        constexpr packed_fixed& operator=(wide_t x) {
+            v = value_t(x.v);
+            return *this;
+        }
+
+        // Arithmetic goes through wide_t (found by ADL, wide_t is the template argument); only the operators
+        // that need an lvalue or would be ambiguous between the two representations are spelled out here
+        friend packed_fixed& operator+=(packed_fixed& a, wide_t b) { return a = wide_t(a) + b; }
+
+        friend packed_fixed& operator-=(packed_fixed& a, wide_t b) { return a = wide_t(a) - b; }
+
+        friend packed_fixed& operator*=(packed_fixed& a, wide_t b) { return a = wide_t(a) * b; }
+
+        friend packed_fixed& operator/=(packed_fixed& a, wide_t b) { return a = wide_t(a) / b; }
+
+        friend auto operator<=>(packed_fixed a, packed_fixed b) { return a.v <=> b.v; }
+
+        friend auto operator<=>(packed_fixed a, wide_t b) { return wide_t(a) <=> b; }
+
+        friend bool operator==(packed_fixed a, packed_fixed b) { return a.v == b.v; }
+
+        friend bool operator==(packed_fixed a, wide_t b) { return wide_t(a) == b; }
+    };
+
+    // How a fluid keeps values of type T in its grids. Arithmetic always happens in T itself
+    template<typename T>
+    struct storage_type {
+        using type = T;
+    };
+
+#if FLUID_COMPACT_STORAGE
+    template<int N, int K>
+        requires (sizeof(real_type_t<N, true>) > sizeof(real_type_t<N, false>))
+    struct storage_type<Fixed<N, K, true>> {
+        using type = packed_fixed<Fixed<N, K, true>>;
+    };
+#endif
+
+    template<typename T>
+    using storage_t = typename storage_type<T>::type;
+
+    // The value a grid entry stands for, in the type the kernels compute with
+    template<typename T>
+    constexpr const T& widen(const T& x) {
+        return x;
+    }
+
+    template<typename Wide>
+    constexpr Wide widen(const packed_fixed<Wide>& x) {
+        return x;
+    }
+
 }
@@ -5,7 +5,6 @@
 #include <algorithm>
 #include <stdexcept>
 #include <sstream>
-#include "fluid-creator.h"
 
 
 class parser {
@@ -24,6 +23,15 @@ public:
         return it->second;
     }
 
+    bool has_option(const std::string& option) const {
+        return comp_options.contains(option);
+    }
+
+    std::string get_option(const std::string& option, const std::string& default_value) const {
+        auto it = comp_options.find(option);
+        return it == comp_options.end() ? default_value : it->second;
+    }
+
 private:
     void option(const std::string& opt_string) {
         auto delimiterPos = opt_string.find('=');
@@ -38,26 +46,3 @@ private:
 
     std::unordered_map<std::string, std::string> comp_options;
 };
-
-bool parse_type(const std::string& typePrefix, const std::string& typeName, int& param1, int& param2) {
-    std::string pattern = typePrefix + "(%d,%d)";
-    return sscanf(typeName.c_str(), pattern.c_str(), &param1, &param2) == 2;
-}
-
-int get_type(const std::string& typeName) {
-    int param1 = 0, param2 = 0;
-    if (parse_type("FIXED", typeName, param1, param2)) {
-        return FIXED(param1, param2);
-    }
-    if (parse_type("FAST_FIXED", typeName, param1, param2)) {
-        return FAST_FIXED(param1, param2);
-    }
-    if (typeName == "DOUBLE") {
-        return DOUBLE;
-    }
-    if (typeName == "FLOAT") {
-        return FLOAT;
-    }
-
-    throw std::invalid_argument("Unknown type: " + typeName);
-}
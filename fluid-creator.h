@@ -2,20 +2,14 @@
 
 
 #include <cinttypes>
+#include <cstdio>
+#include <string>
 #include <type_traits>
 #include <array>
 #include <iostream>
 #include "fluid.h"
+#include "type-codes.h"
 
-//==============================//
-// Macros for type definitions  //
-//==============================//
-
-#define FLOAT 1
-#define DOUBLE 2
-#define FIXED(n, k) ((n) * 1000 + (k))
-#define FAST_FIXED(n, k) ((n) * 100000 + (k))
-#define BASESIZE(n, m) std::pair<int, int>((n), (m))
 // Check if DTYPES is defined, otherwise raise a compile-time error
 #ifndef DTYPES
 #error "Types are not definded"
@@ -27,21 +21,6 @@
 
 namespace Pepega {
 
-    //==============================//
-    // Type determination template  //
-    //==============================//
-
-    // Template struct to determine the type based on an integer value
-    template<int n>
-    struct get_type_inner {
-        using type = std::conditional_t<n == 1, float, std::conditional_t<n == 2, double,
-        std::conditional_t<(n > 100000), Fixed<n / 100000, n % 100000, true>,
-        std::conditional_t<(n > 1000), Fixed<n / 1000, n % 1000>, void>>>>;
-    };
-
-    template<int n>
-    using get_type = get_type_inner<n>::type;
-
     constexpr auto create_variatons() {
         constexpr std::pair<int, int> givenSizes[] = {DSIZES, {-1, -1}};
         constexpr int sizesCnt = sizeof(givenSizes) / sizeof(std::pair<int, int>);
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "fluid.h"
+#include "flags-parser.h"
+#include "fluid-creator.h"
+
+//==============================//
+// Simulation daemon            //
+//==============================//
+
+// Keeps simulations resident and steps them on worker pools started once, so a short run costs neither
+// process startup nor a pool of its own. Clients connect to a Unix domain socket and send one command
+// per line, the options in the usual --key=value form; every command gets one line back, "ok ..." or
+// "error <message>":
+//   load --job=NAME --input-file=PATH --p-type=T --v-type=T --v-flow-type=T [--priority=0] [--seed=1337]
+//   step --job=NAME --ticks=N [--wait=on]
+//   snapshot --job=NAME --save-file=PATH
+//   stats --job=NAME
+//   cancel --job=NAME
+//   shutdown
+// The cores are split into lanes, pools of --threads / --lanes workers. A free lane takes the job with the
+// highest priority that has work (its load or ticks still to step), the one that waited longest among
+// equals, and runs it for at most --slice ticks before choosing again: a job of higher priority gets the
+// next free lane within a slice, lower ones share what is left
+
+namespace {
+    struct job {
+        std::string input_file;
+        int priority = 0;
+        std::shared_ptr<Pepega::fluid_base> fluid;
+        // The job's own random sequence, swapped into the lane's Pepega::rnd for every slice: the result
+        // doesn't depend on which lanes ran the job or what ran in between
+        std::mt19937 rng;
+        bool loaded = false;
+        std::string error;
+        long long tick = 0;
+        long long pending = 0;
+        // Taken by a lane or by a command reading the state, nobody else touches the fluid meanwhile
+        bool busy = false;
+        // Commands waiting for the lane to let go of the job, which isn't picked again until they are done;
+        // a job that isn't loaded yet is still picked for its load, which is what they wait for
+        int readers = 0;
+        std::atomic<bool> cancelled = false;
+        unsigned long long last_run = 0;
+    };
+
+    class fluid_daemon {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::map<std::string, std::shared_ptr<job>> jobs;
+        std::vector<std::unique_ptr<BuddiesForeman>> pools;
+        std::vector<std::thread> lanes;
+        unsigned long long runs = 0;
+        long long slice;
+        bool stopping = false;
+        int listener = -1;
+
+        // Next job for a free lane, under the mutex
+        std::shared_ptr<job> pick() {
+            std::shared_ptr<job> best;
+            for (auto &[name, j]: jobs) {
+                if (j->busy || (j->loaded && j->readers > 0) || j->cancelled || !j->error.empty() || (j->loaded && j->pending == 0)) {
+                    continue;
+                }
+                if (!best || j->priority > best->priority ||
+                    (j->priority == best->priority && j->last_run < best->last_run)) {
+                    best = j;
+                }
+            }
+            return best;
+        }
+
+        void lane(BuddiesForeman &pool) {
+            std::unique_lock lock(mutex);
+            while (true) {
+                std::shared_ptr<job> j;
+                changed.wait(lock, [&] { return stopping || (j = pick()); });
+                if (stopping) {
+                    return;
+                }
+                j->busy = true;
+                bool load = !j->loaded;
+                long long tick = j->tick, count = std::min(j->pending, slice);
+                lock.unlock();
+
+                long long done = 0;
+                std::string error;
+                try {
+                    j->fluid->share_workers(pool);
+                    if (load) {
+                        j->fluid->load_parallel(j->input_file);
+                    } else {
+                        Pepega::rnd = j->rng;
+                        for (; done < count && !j->cancelled; ++done) {
+                            j->fluid->next(int(tick + done));
+                        }
+                        j->rng = Pepega::rnd;
+                    }
+                } catch (const std::exception &e) {
+                    error = e.what();
+                }
+
+                lock.lock();
+                j->busy = false;
+                j->loaded = j->loaded || (load && error.empty());
+                j->error = error;
+                j->tick += done;
+                j->pending = j->cancelled ? 0 : j->pending - done;
+                j->last_run = ++runs;
+                changed.notify_all();
+            }
+        }
+
+        std::shared_ptr<job> find(const std::string &name) {
+            auto it = jobs.find(name);
+            if (it == jobs.end()) {
+                throw std::invalid_argument("No job " + name);
+            }
+            return it->second;
+        }
+
+        // Waits until the job is loaded and no lane runs it, then keeps the lanes off it until release()
+        std::shared_ptr<job> acquire(std::unique_lock<std::mutex> &lock, const std::string &name) {
+            auto j = find(name);
+            ++j->readers;
+            changed.wait(lock, [&] { return j->cancelled || !j->error.empty() || (j->loaded && !j->busy); });
+            --j->readers;
+            if (j->cancelled) {
+                throw std::runtime_error("Job " + name + " was cancelled");
+            }
+            if (!j->error.empty()) {
+                throw std::runtime_error(j->error);
+            }
+            j->busy = true;
+            return j;
+        }
+
+        void release(std::unique_lock<std::mutex> &lock, job &j) {
+            lock.lock();
+            j.busy = false;
+            changed.notify_all();
+        }
+
+        std::string load(const parser &options) {
+            auto name = options.get_option("--job");
+            auto input_file = options.get_option("--input-file");
+            auto p_type = get_type(options.get_option("--p-type"));
+            auto v_type = get_type(options.get_option("--v-type"));
+            auto v_flow_type = get_type(options.get_option("--v-flow-type"));
+
+            std::ifstream input(input_file);
+            int n, m;
+            if (!(input >> n >> m)) {
+                throw std::invalid_argument("Can't read " + input_file);
+            }
+            auto j = std::make_shared<job>();
+            j->input_file = input_file;
+            j->priority = std::stoi(options.get_option("--priority", "0"));
+            j->rng.seed(std::stoul(options.get_option("--seed", "1337")));
+            j->fluid = create_fluid(p_type, v_type, v_flow_type, n, m);
+            j->fluid->set_field_output(false);
+
+            std::lock_guard lock(mutex);
+            if (!jobs.emplace(name, j).second) {
+                throw std::invalid_argument("Job " + name + " already exists");
+            }
+            changed.notify_all();
+            return "ok";
+        }
+
+        std::string step(const parser &options) {
+            auto name = options.get_option("--job");
+            long long ticks = std::stoll(options.get_option("--ticks"));
+            auto wait = options.get_option("--wait", "on");
+            if (ticks < 0) {
+                throw std::invalid_argument("--ticks must be non-negative");
+            }
+            if (wait != "on" && wait != "off") {
+                throw std::invalid_argument("Unknown wait mode: " + wait);
+            }
+
+            std::unique_lock lock(mutex);
+            auto j = find(name);
+            j->pending += ticks;
+            changed.notify_all();
+            if (wait == "on") {
+                changed.wait(lock, [&] {
+                    return j->cancelled || !j->error.empty() || (j->loaded && !j->busy && j->pending == 0);
+                });
+                if (j->cancelled) {
+                    throw std::runtime_error("Job " + name + " was cancelled");
+                }
+                if (!j->error.empty()) {
+                    throw std::runtime_error(j->error);
+                }
+            }
+            return "ok tick=" + std::to_string(j->tick) + " pending=" + std::to_string(j->pending);
+        }
+
+        std::string snapshot(const parser &options) {
+            auto save_file = options.get_option("--save-file");
+            std::unique_lock lock(mutex);
+            auto j = acquire(lock, options.get_option("--job"));
+            lock.unlock();
+            bool written;
+            {
+                std::ofstream out(save_file, std::ios::trunc);
+                j->fluid->save(out);
+                written = bool(out);
+            }
+            release(lock, *j);
+            if (!written) {
+                throw std::runtime_error("Can't write " + save_file);
+            }
+            return "ok tick=" + std::to_string(j->tick);
+        }
+
+        std::string stats(const parser &options) {
+            std::unique_lock lock(mutex);
+            auto j = acquire(lock, options.get_option("--job"));
+            long long tick = j->tick, pending = j->pending;
+            lock.unlock();
+            auto s = j->fluid->stats();
+            release(lock, *j);
+
+            std::ostringstream out;
+            out << "ok n=" << s.n << " m=" << s.m << " tick=" << tick << " pending=" << pending
+                << " last_active=" << s.last_active << " cells=" << s.cells << " total_p=" << s.total_p
+                << " max_velocity=" << s.max_velocity << " priority=" << j->priority;
+            return out.str();
+        }
+
+        std::string cancel(const parser &options) {
+            auto name = options.get_option("--job");
+            std::unique_lock lock(mutex);
+            auto j = find(name);
+            j->cancelled = true;
+            j->pending = 0;
+            changed.notify_all();
+            // A lane stops the job after the current tick; the fluid is dropped once nobody uses it
+            changed.wait(lock, [&] { return !j->busy; });
+            jobs.erase(name);
+            return "ok tick=" + std::to_string(j->tick);
+        }
+
+        std::string execute(const std::string &line) {
+            std::istringstream in(line);
+            std::vector<std::string> words;
+            for (std::string word; in >> word;) {
+                words.push_back(word);
+            }
+            if (words.empty()) {
+                throw std::invalid_argument("Empty command");
+            }
+            std::vector<char *> argv;
+            for (auto &word: words) {
+                argv.push_back(word.data());
+            }
+            parser options(int(argv.size()), argv.data());
+
+            auto &command = words[0];
+            if (command == "load") {
+                return load(options);
+            }
+            if (command == "step") {
+                return step(options);
+            }
+            if (command == "snapshot") {
+                return snapshot(options);
+            }
+            if (command == "stats") {
+                return stats(options);
+            }
+            if (command == "cancel") {
+                return cancel(options);
+            }
+            if (command == "shutdown") {
+                stop();
+                return "ok";
+            }
+            throw std::invalid_argument("Unknown command: " + command);
+        }
+
+        void serve(int client) {
+            std::string buffer;
+            char chunk[4096];
+            ssize_t got;
+            while ((got = read(client, chunk, sizeof(chunk))) > 0) {
+                buffer.append(chunk, size_t(got));
+                size_t end;
+                while ((end = buffer.find('\n')) != std::string::npos) {
+                    auto line = buffer.substr(0, end);
+                    buffer.erase(0, end + 1);
+                    std::string reply;
+                    try {
+                        reply = execute(line);
+                    } catch (const std::exception &e) {
+                        reply = std::string("error ") + e.what();
+                    }
+                    reply += '\n';
+                    if (send(client, reply.data(), reply.size(), MSG_NOSIGNAL) < 0) {
+                        close(client);
+                        return;
+                    }
+                }
+            }
+            close(client);
+        }
+
+    public:
+        fluid_daemon(int threads, int lane_count, long long slice) : slice(slice) {
+            if (threads < 1 || lane_count < 1 || lane_count > threads) {
+                throw std::invalid_argument("Need at least 1 lane and at least 1 thread per lane");
+            }
+            if (slice < 1) {
+                throw std::invalid_argument("--slice must be at least 1 tick");
+            }
+            for (int i = 0; i < lane_count; ++i) {
+                pools.push_back(std::make_unique<BuddiesForeman>());
+                pools.back()->init(threads * (i + 1) / lane_count - threads * i / lane_count);
+            }
+            for (auto &pool: pools) {
+                lanes.emplace_back(&fluid_daemon::lane, this, std::ref(*pool));
+            }
+        }
+
+        // Lets the lanes finish their slices and stops the pools, after stop()
+        void join() {
+            for (auto &lane: lanes) {
+                lane.join();
+            }
+            for (auto &pool: pools) {
+                pool->stop_all();
+            }
+        }
+
+        void stop() {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            changed.notify_all();
+            // Wakes up accept() in listen()
+            if (listener >= 0) {
+                shutdown(listener, SHUT_RDWR);
+            }
+        }
+
+        void listen_on(const std::string &path) {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path)) {
+                throw std::invalid_argument("Socket path is too long: " + path);
+            }
+            std::strcpy(address.sun_path, path.c_str());
+
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) {
+                throw std::runtime_error(std::string("Can't create a socket: ") + std::strerror(errno));
+            }
+            unlink(path.c_str());
+            if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(fd, 16) < 0) {
+                auto reason = std::string(std::strerror(errno));
+                close(fd);
+                throw std::runtime_error("Can't listen on " + path + ": " + reason);
+            }
+            {
+                std::lock_guard lock(mutex);
+                listener = fd;
+            }
+
+            while (true) {
+                int client = accept(fd, nullptr, nullptr);
+                if (client < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                // Connections live as long as their client; one left open at shutdown dies with the process
+                std::thread(&fluid_daemon::serve, this, client).detach();
+            }
+            {
+                std::lock_guard lock(mutex);
+                listener = -1;
+            }
+            close(fd);
+            unlink(path.c_str());
+        }
+    };
+}
+
+int main(int argc, char *argv[]) {
+    parser options_parser(argc, argv);
+
+    auto socket_path = options_parser.get_option("--socket");
+    int threads = std::stoi(options_parser.get_option("--threads",
+                                                      std::to_string(std::max(1u, std::thread::hardware_concurrency()))));
+    int lane_count = std::stoi(options_parser.get_option("--lanes", "1"));
+    long long slice = std::stoll(options_parser.get_option("--slice", "16"));
+
+    // Owned by main and never destroyed: connection threads may still be reading when main returns
+    auto *daemon = new fluid_daemon(threads, lane_count, slice);
+    std::cout << "Kernels: " << Pepega::kernel_target() << std::endl;
+    std::cout << "Listening on " << socket_path << ", " << lane_count << " lanes, " << threads << " threads"
+              << std::endl;
+    daemon->listen_on(socket_path);
+    daemon->join();
+    std::cout << "Stopped" << std::endl;
+    return 0;
+}
@@ -11,12 +11,21 @@
 #include <sstream>
 #include <optional>
 #include <fstream>
+#include <filesystem>
+#include <chrono>
 
 #include "vector-field.h"
 #include "crutches.h"
 #include "fixed.h"
 #include "missions.h"
 #include "buddies.h"
+#include "replay-verifier.h"
+#include "text-loader.h"
+#include "auto-tune.h"
+#include "state-view.h"
+#include "steady-state.h"
+#include "multilevel-flow.h"
+#include "trace.h"
 
 using namespace std;
 
@@ -29,12 +38,42 @@ namespace Pepega {
     class fluid_base {
     public:
         virtual void next(int) = 0;
+        // Ticks first .. first + n - 1, the same as calling next for each of them
+        virtual void step(int first, int n) = 0;
         virtual void load(std::ifstream& file) = 0;
+        virtual void load_parallel(const std::string& path) = 0;
         virtual void save(std::ofstream& file) = 0;
 
+        virtual void set_placement(const placement_policy&) = 0;
+        virtual void set_auto_tune(bool) = 0;
+        virtual void set_small_grid(int inline_cells, int spin) = 0;
+        // Pipelined phases (see run_wavefront), on by default
+        virtual void set_wavefront(bool) = 0;
+        virtual void report_tuning(std::ostream&) = 0;
         virtual void init_workers(int) = 0;
+        // Runs on a pool the caller owns instead of starting one, e.g. the resident pools of fluid-daemon.
+        // The pool must not run anything else while this simulator uses it
+        virtual void share_workers(BuddiesForeman&) = 0;
         virtual void kill_everyone() = 0;
 
+        virtual void attach_verifier(const std::string& path, bool record) = 0;
+        // Timeline of the tick phases and of every worker (see trace.h), call after init_workers.
+        // write_trace stops recording and writes the file
+        virtual void attach_trace(const std::string& path, size_t events_per_thread) = 0;
+        virtual void write_trace() = 0;
+
+        virtual bool open_state(const std::string& dir) = 0;
+        virtual void sync_state() = 0;
+
+        virtual void set_field_output(bool) = 0;
+        virtual void set_flow_solver(flow_solver, int block) = 0;
+        virtual plane_view view(state_plane) = 0;
+        virtual fluid_stats stats() = 0;
+
+        // Convergence monitoring: with it on, every tick ends with a tick_sample (call before loading)
+        virtual void set_convergence(bool) = 0;
+        virtual tick_sample last_sample() = 0;
+
         virtual ~fluid_base() = default;
     };
 
@@ -50,48 +89,200 @@ namespace Pepega {
         using p_type = p_t;
         using v_type = velocity_t;
         using vf_type = velocity_flow_t;
+        // What the grids hold, see storage_type: arithmetic is done in the types above
+        using p_store = storage_t<p_t>;
+        using v_store = storage_t<velocity_t>;
+        using vf_store = storage_t<velocity_flow_t>;
         using full_type = fluid<p_t, velocity_t, velocity_flow_t, value_N, value_M>;
 
         Array<char, value_N, value_M> field{};
-        Array<p_t, value_N, value_M> p{}, old_p{};
+        Array<p_store, value_N, value_M> p{}, old_p{};
         Array<int64_t, value_M, value_M> dirs{};
         Array<int, value_M, value_M> last_use{};
-        VectorField<velocity_t, value_N, value_M> velocity = {};
-        VectorField<velocity_flow_t, value_N, value_M> velocity_flow = {};
+        // Move phase: cell is known to be stoppable in this tick if it holds UT (see is_stoppable_memo)
+        Array<int, value_N, value_M> stoppable{};
+        // Outgoing velocities of every cell for the move phase, rebuilt by p_recalculation (see update_move_table)
+        struct move_table {
+            std::array<v_store, deltas.size()> prefix;
+            uint8_t mask;
+        };
+        Array<move_table, value_N, value_M> move_tables{};
+        // Pressure each cell hands out in the recalculation phase, bit Dir of mask set when slot Dir is used;
+        // the receiving cells collect it themselves (see p_collect)
+        struct pressure_push {
+            std::array<p_store, deltas.size()> value;
+            uint8_t mask;
+        };
+        Array<pressure_push, value_N, value_M> pushes{};
+        // Reusable stack of propagate_stop
+        std::vector<std::pair<int, int>> stop_frontier;
+        VectorField<v_store, value_N, value_M> velocity = {};
+        VectorField<vf_store, value_N, value_M> velocity_flow = {};
+        // Edges the flow phase can use, bit Dir per cell (see flow_edges_mission): towards an open cell and
+        // with a capacity propagate_flow doesn't treat as 0. Only these slots of velocity_flow are ever written,
+        // so the next tick clears just them
+        Array<uint8_t, value_N, value_M> flow_edges{};
         int UT = 0;
         int last_active = 0;
+        // Convergence monitoring (see steady-state.h): velocity after the previous recalculation and the per-row
+        // partials p_collect leaves (see convergence_sample)
+        bool convergence = false;
+        bool random_free = false;
+        VectorField<v_store, value_N, value_M> previous_velocity = {};
+        std::vector<uint64_t> row_hashes;
+        std::vector<double> row_p_residual, row_v_residual;
+        tick_sample sample{};
         p_t rho[256];
 
-        Array<std::mutex, value_N, value_M> p_mutex{};
-
-        std::vector<std::unique_ptr<Mission>> g_tasks;
-        std::vector<std::unique_ptr<Mission>> p_tasks;
-        std::vector<std::unique_ptr<Mission>> recalc_p_tasks;
         std::vector<std::unique_ptr<Mission>> output_field_task;
 
         BuddiesForeman main_handler{};
+        // Pool the phases run on: main_handler, or one lent by share_workers
+        BuddiesForeman *workers = &main_handler;
         BuddiesForeman output_handler{};
 
-        void update_p(int x, int y, const p_t &val) {
-            std::lock_guard lock(p_mutex[x][y]);
-            p[x][y] += val;
+        std::unique_ptr<replay_verifier> verifier;
+        std::unique_ptr<worker_trace> trace;
+        std::string trace_path;
+        placement_policy placement{};
+        std::string state_dir;
+        bool auto_tune = false;
+        bool field_output_enabled = true;
+        flow_solver solver = flow_solver::classic;
+        // Declared before the member, which instantiates the solver's class right here
+        friend class multilevel_flow<full_type>;
+        multilevel_flow<full_type> multilevel;
+        // Grids of at most this many cells run the parallel phases on the calling thread
+        int inline_cells = 2048;
+        int spin = 2000;
+        // Indexed by tick_phase, only the parallel phases are used
+        std::array<phase_tuner, 5> tuners;
+        // Wavefront phases: the generation each band of rows finished its first stage in. A cache line each,
+        // neighbouring bands are finished by different workers at the same time
+        struct alignas(64) band_flag {
+            std::atomic<int> done = 0;
+        };
+        std::unique_ptr<band_flag[]> band_flags;
+        int band_count = 0;
+        int wave = 0;
+        bool wavefront = true;
+
+        // Rows read ahead by the serial sweeps when the grids are file-backed
+        static constexpr int stream_band = 64;
+
+        // Hash of field, p and velocity, localized by rows and columns
+        state_hashes hash_state() {
+            state_hashes h;
+            h.rows.assign(N, 0);
+            h.cols.assign(M, 0);
+            for (int x = 0; x < N; ++x) {
+                uint64_t row = 0;
+                for (int y = 0; y < M; ++y) {
+                    uint64_t cell = hash_mix(hash_bits(field[x][y]), hash_bits(p[x][y]));
+                    for (const auto &v: velocity.v[x][y]) {
+                        cell = hash_mix(cell, hash_bits(v));
+                    }
+                    row = hash_mix(row, cell);
+                    h.cols[y] = static_cast<uint32_t>(hash_mix(h.cols[y], cell));
+                }
+                h.rows[x] = static_cast<uint32_t>(row);
+                h.total = hash_mix(h.total, row);
+            }
+            return h;
         }
 
-        void init() {
-            velocity_flow.v.init(N, M);
-            dirs.init(N, M);
-            old_p.init(N, M);
-            last_use.init(N, M);
-            p.init(N, M);
-            old_p.init(N, M);
-            p_mutex.init(N, M);
+        void verify(int tick, tick_phase phase) {
+            if (verifier) {
+                verifier->check(tick, phase, hash_state());
+            }
+        }
+
+        // Dynamic grids are mapped untouched, then every row is constructed either by the main thread
+        // or, with first_touch::workers, by the worker whose band it belongs to.
+        // With a state directory the grids are plane files instead; `resume` keeps the saved state planes
+        void allocate_grids(bool resume = false) {
+            bool huge = placement.huge_pages;
+            auto place = [&](auto &arr, const char *name, bool state) {
+                if (state_dir.empty()) {
+                    arr.allocate(N, M, huge);
+                    return;
+                }
+                bool reused = arr.map_file(state_dir + "/" + name + ".plane", N, M);
+                if (resume && state && !reused) {
+                    throw std::runtime_error("State directory " + state_dir + " has no valid " + name + " plane");
+                }
+                if (reused && !(resume && state)) {
+                    arr.clear();
+                }
+            };
+            place(field, "field", true);
+            place(p, "p", true);
+            place(old_p, "old_p", false);
+            place(dirs, "dirs", false);
+            place(last_use, "last_use", true);
+            place(velocity.v, "velocity", true);
+            place(velocity_flow.v, "velocity_flow", false);
+            place(flow_edges, "flow_edges", false);
+            place(stoppable, "stoppable", false);
+            place(move_tables, "move_tables", false);
+            place(pushes, "pushes", false);
+            if (convergence) {
+                place(previous_velocity.v, "previous_velocity", false);
+                row_hashes.assign(N, 0);
+                row_p_residual.assign(N, 0);
+                row_v_residual.assign(N, 0);
+            }
+            if (!state_dir.empty()) {
+                // Planes are modified in place from now on, the state is complete again only after sync_state()
+                std::filesystem::remove(state_dir + "/meta");
+            }
 
-            for (int i = 0; i < N; i++) {
-                g_tasks.push_back(std::make_unique<g_mission<full_type>>(i, *this));
-                p_tasks.push_back(std::make_unique<p_mission<full_type>>(i, *this));
-                recalc_p_tasks.push_back(std::make_unique<p_recalculation<full_type>>(i, *this));
+            if (placement.touch == first_touch::workers) {
+                workers->parallel_for(N, 1, [&](int from, int to) {
+                    for (int i = from; i < to; i++) {
+                        touch_row(i);
+                    }
+                }, -1, "first touch");
+            } else {
+                for (int i = 0; i < N; i++) {
+                    touch_row(i);
+                }
             }
+        }
 
+        // Serial sweeps over file-backed grids read the next band of rows ahead while this one is processed
+        void stream_rows(int x) {
+            if (state_dir.empty() || x % stream_band != 0) {
+                return;
+            }
+            int from = x == 0 ? 0 : x + stream_band;
+            int to = x + 2 * stream_band;
+            field.prefetch_rows(from, to);
+            last_use.prefetch_rows(from, to);
+            p.prefetch_rows(from, to);
+            velocity.v.prefetch_rows(from, to);
+            velocity_flow.v.prefetch_rows(from, to);
+            flow_edges.prefetch_rows(from, to);
+        }
+
+        void touch_row(int x) {
+            field.touch_rows(x, x + 1);
+            p.touch_rows(x, x + 1);
+            old_p.touch_rows(x, x + 1);
+            dirs.touch_rows(x, x + 1);
+            last_use.touch_rows(x, x + 1);
+            velocity.v.touch_rows(x, x + 1);
+            velocity_flow.v.touch_rows(x, x + 1);
+            flow_edges.touch_rows(x, x + 1);
+            stoppable.touch_rows(x, x + 1);
+            move_tables.touch_rows(x, x + 1);
+            if (convergence) {
+                previous_velocity.v.touch_rows(x, x + 1);
+            }
+            pushes.touch_rows(x, x + 1);
+        }
+
+        void init() {
             output_field_task.push_back(std::make_unique<field_output<full_type>>(*this));
 
 
@@ -101,9 +292,10 @@ namespace Pepega {
                 for (int y = 0; y < M; ++y) {
                     if (field[x][y] == '#')
                         continue;
-                    for (auto [dx, dy]: deltas) {
+                    for_each_dir([&]<int Dir>() {
+                        constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                         dirs[x][y] += (field[x + dx][y + dy] != '#');
-                    }
+                    });
                 }
             }
         }
@@ -111,23 +303,27 @@ namespace Pepega {
         std::tuple<velocity_flow_t, bool, pair<int, int>> propagate_flow(int x, int y, velocity_flow_t lim) {
             last_use[x][y] = UT - 1;
             velocity_flow_t ret{};
-            for (auto [dx, dy] : deltas) {
+            std::tuple<velocity_flow_t, bool, pair<int, int>> found;
+            uint8_t edges = flow_edges[x][y];
+            bool stopped = any_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                 int nx = x + dx, ny = y + dy;
-                if (field[nx][ny] == '#' || last_use[nx][ny] >= UT) {
-                    continue;
+                // Walls and edges without capacity are left out of the mask
+                if (!(edges >> Dir & 1) || last_use[nx][ny] >= UT) {
+                    return false;
                 }
-                if (nx < 0 || nx >= N || ny < 0 || ny >= M) continue;
 
-                velocity_t cap = velocity.get(x, y, dx, dy);
-                velocity_flow_t flow = velocity_flow.get(x, y, dx, dy);
+                velocity_t cap = velocity.template get<Dir>(x, y);
+                velocity_flow_t flow = velocity_flow.template get<Dir>(x, y);
                 if (fabs(flow - velocity_flow_t(cap)) <= 0.0001) {
-                    continue;
+                    return false;
                 }
                 velocity_flow_t vp = std::min(lim, velocity_flow_t(cap) - flow);
                 if (last_use[nx][ny] == UT - 1) {
-                    velocity_flow.add(x, y, dx, dy, vp);
+                    velocity_flow.template add<Dir>(x, y, vp);
                     last_use[x][y] = UT;
-                    return {vp, true, {nx, ny}};
+                    found = {vp, true, {nx, ny}};
+                    return true;
                 }
                     //auto [t, prop, end] = propagate_flow(nx, ny, vp);
                 velocity_flow_t t;
@@ -139,59 +335,114 @@ namespace Pepega {
 
                 ret += t;
                 if (prop) {
-                    velocity_flow.add(x, y, dx, dy, t);
+                    velocity_flow.template add<Dir>(x, y, t);
                     last_use[x][y] = UT;
-                    return {t, prop && end != pair(x, y), end};
+                    found = {t, prop && end != pair(x, y), end};
+                    return true;
                 }
-
+                return false;
+            });
+            if (stopped) {
+                return found;
             }
             last_use[x][y] = UT;
             return {ret, false, {0, 0}};
         }
 
         inline bool is_stoppable(int x, int y) {
-            for (auto [dx, dy]: deltas) {
+            return not any_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                 int nx = x + dx, ny = y + dy;
-                if (field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 && velocity.get(x, y, dx, dy) > int64_t(0)) {
-                    return false;
-                }
+                return field[nx][ny] != '#' && last_use[nx][ny] < UT - 1 &&
+                       velocity.template get<Dir>(x, y) > int64_t(0);
+            });
+        }
+
+        // Marking cells only takes neighbours out of is_stoppable's condition, so within a tick a stoppable cell
+        // stays stoppable until its own velocity changes, which only swap() does. Only positive answers are kept
+        bool is_stoppable_memo(int x, int y) {
+            if (stoppable[x][y] == UT) {
+                return true;
             }
+            if (not is_stoppable(x, y)) {
+                return false;
+            }
+            stoppable[x][y] = UT;
             return true;
         }
 
+        // Depth-first like the original std::stack version: is_stoppable depends on the cells marked so far,
+        // so the visiting order is part of the result
         void propagate_stop(int x_, int y_) {
-            std::stack<std::pair<int, int>> nxt;
-            nxt.emplace(x_, y_);
+            auto &nxt = stop_frontier;
+            nxt.clear();
+            nxt.emplace_back(x_, y_);
             last_use[x_][y_] = UT;
             while (not nxt.empty()) {
-                auto [x, y] = nxt.top();
-                nxt.pop();
-                for (auto [dx, dy]: deltas) {
+                auto [x, y] = nxt.back();
+                nxt.pop_back();
+                for_each_dir([&]<int Dir>() {
+                    constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                     int nx = x + dx, ny = y + dy;
-                    if (field[nx][ny] == '#' || last_use[nx][ny] == UT || velocity.get(x, y, dx, dy) > int64_t(0) ||
-                        not is_stoppable(nx, ny)) {
-                        continue;
+                    if (field[nx][ny] == '#' || last_use[nx][ny] == UT ||
+                        velocity.template get<Dir>(x, y) > int64_t(0) || not is_stoppable_memo(nx, ny)) {
+                        return;
                     }
                     last_use[nx][ny] = UT;
-                    nxt.emplace(nx, ny);
-                }
+                    nxt.emplace_back(nx, ny);
+                });
             }
         }
 
+        // What move_prob and propagate_move sum for (x, y) while none of its neighbours is marked with UT: the
+        // non-negative outgoing velocities towards open cells, as prefix sums in deltas order, and which of the
+        // directions contribute. Depends on the cell's velocity and the walls around it only
+        void update_move_table(int x, int y) {
+            auto &t = move_tables[x][y];
+            velocity_t sum{};
+            t.mask = 0;
+            for_each_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
+                int nx = x + dx, ny = y + dy;
+                if (nx >= 0 && nx < N && ny >= 0 && ny < M && field[nx][ny] != '#') {
+                    velocity_t v = velocity.template get<Dir>(x, y);
+                    if (!(v < int64_t(0))) {
+                        sum += v;
+                        t.mask |= 1 << Dir;
+                    }
+                }
+                t.prefix[Dir] = sum;
+            });
+        }
+
+        // The table of (x, y) is what a scan would compute unless a contributing neighbour is already marked
+        const move_table *valid_move_table(int x, int y) {
+            const auto &t = move_tables[x][y];
+            bool marked = any_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
+                return (t.mask >> Dir & 1) && last_use[x + dx][y + dy] == UT;
+            });
+            return marked ? nullptr : &t;
+        }
+
         velocity_t move_prob(int x, int y) {
+            if (auto t = valid_move_table(x, y)) {
+                return t->prefix.back();
+            }
             velocity_t sum{};
-            for (auto [dx, dy] : deltas) {
+            for_each_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                 int nx = x + dx, ny = y + dy;
-                if (nx < 0 || nx >= N || ny < 0 || ny >= M) continue;
+                if (nx < 0 || nx >= N || ny < 0 || ny >= M) return;
                 if (field[nx][ny] == '#' || last_use[nx][ny] == UT) {
-                    continue;
+                    return;
                 }
-                velocity_t v = velocity.get(x, y, dx, dy);
+                velocity_t v = velocity.template get<Dir>(x, y);
                 if (v < 0ll) {
-                    continue;
+                    return;
                 }
                 sum += v;
-            }
+            });
             return sum;
         }
 
@@ -199,6 +450,10 @@ namespace Pepega {
             std::swap(field[x1][y1], field[x2][y2]);
             std::swap(p[x1][y1], p[x2][y2]);
             std::swap(velocity.v[x1][y1], velocity.v[x2][y2]);
+            stoppable[x1][y1] = stoppable[x2][y2] = 0;
+            // The walls around the two cells differ, so the tables are rebuilt rather than swapped
+            update_move_table(x1, y1);
+            update_move_table(x2, y2);
         }
 
         bool propagate_move(int x, int y, bool is_first) {
@@ -208,21 +463,26 @@ namespace Pepega {
             do {
                 std::array<velocity_t, deltas.size()> tres;
                 velocity_t sum{};
-                for (size_t i = 0; i < deltas.size(); ++i) {
-                    auto [dx, dy] = deltas[i];
-                    int fx = x + dx, fy = y + dy;
-                    if (fx < 0 || fx >= N || fy < 0 || fy >= M) continue;
-                    if (field[fx][fy] == '#' || last_use[fx][fy] == UT) {
-                        tres[i] = sum;
-                        continue;
-                    }
-                    velocity_t v = velocity.get(x, y, dx, dy);
-                    if (v < 0ll) {
-                        tres[i] = sum;
-                        continue;
-                    }
-                    sum += v;
-                    tres[i] = sum;
+                if (auto t = valid_move_table(x, y)) {
+                    std::copy(t->prefix.begin(), t->prefix.end(), tres.begin());
+                    sum = tres.back();
+                } else {
+                    for_each_dir([&]<int Dir>() {
+                        constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
+                        int fx = x + dx, fy = y + dy;
+                        if (fx < 0 || fx >= N || fy < 0 || fy >= M) return;
+                        if (field[fx][fy] == '#' || last_use[fx][fy] == UT) {
+                            tres[Dir] = sum;
+                            return;
+                        }
+                        velocity_t v = velocity.template get<Dir>(x, y);
+                        if (v < 0ll) {
+                            tres[Dir] = sum;
+                            return;
+                        }
+                        sum += v;
+                        tres[Dir] = sum;
+                    });
                 }
 
                 if (sum == 0ll) {
@@ -235,37 +495,120 @@ namespace Pepega {
                 auto [dx, dy] = deltas[d];
                 nx = x + dx;
                 ny = y + dy;
-                assert(velocity.get(x, y, dx, dy) > 0ll && field[nx][ny] != '#' && last_use[nx][ny] < UT);
+                assert(velocity.v[x][y][d] > 0ll && field[nx][ny] != '#' && last_use[nx][ny] < UT);
 
                 ret = (last_use[nx][ny] == UT - 1 || propagate_move(nx, ny, false));
             } while (!ret);
             last_use[x][y] = UT;
-            for (auto [dx, dy] : deltas) {
+            for_each_dir([&]<int Dir>() {
+                constexpr auto dx = deltas[Dir].first, dy = deltas[Dir].second;
                 int fx = x + dx, fy = y + dy;
-                if (fx < 0 || fx >= N || fy < 0 || fy >= M) continue;
-                if (field[fx][fy] != '#' && last_use[fx][fy] < UT - 1 && velocity.get(x, y, dx, dy) < 0ll) {
+                if (fx < 0 || fx >= N || fy < 0 || fy >= M) return;
+                if (field[fx][fy] != '#' && last_use[fx][fy] < UT - 1 && velocity.template get<Dir>(x, y) < 0ll) {
                     propagate_stop(nx, ny);
                 }
-            }
+            });
             if (ret && !is_first) {
                 swap(x, y, nx, ny);
             }
             return ret;
         }
 
+        // Runs a parallel phase over the rows, under auto-tuning with the workers and grain its tuner asks for.
+        // Kernels are row kernels of missions.h, run one after another over all rows: a kernel starts only
+        // when every row of the previous one is done. The phase is tuned as a whole
+        template<typename... Kernels>
+        void run_phase(tick_phase phase) {
+            // A phase of a small grid costs less than waking the pool up and waiting for it
+            if (int64_t(N) * M <= inline_cells) {
+                (Kernels::run(*this, 0, N), ...);
+                return;
+            }
+            auto config = auto_tune ? tuners[int(phase)].config() : pool_config{workers->size(), 1};
+            auto start = std::chrono::steady_clock::now();
+            (workers->parallel_for(N, config.grain, [this](int from, int to) {
+                Kernels::run(*this, from, to);
+            }, config.workers, phase_name(phase)), ...);
+            if (auto_tune) {
+                tuners[int(phase)].report(
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+
+        // Runs two row kernels where row x of Second needs First done on rows x - 1 .. x + 1 only, without the
+        // barrier between them. The rows are cut into bands of the tuner's grain and the tasks are handed out
+        // in the order First 0, First 1, Second 0, First 2, Second 1, ...: Second of band b waits for the flags of
+        // bands b - 1 .. b + 1, whose First tasks were all taken earlier by running workers, so the wait always
+        // ends, and Second starts on the first bands while First is still running on the last ones
+        template<typename First, typename Second>
+        void run_wavefront(tick_phase phase, const char *name) {
+            if (int64_t(N) * M <= inline_cells) {
+                First::run(*this, 0, N);
+                Second::run(*this, 0, N);
+                return;
+            }
+            auto config = auto_tune ? tuners[int(phase)].config() : pool_config{workers->size(), 1};
+            auto start = std::chrono::steady_clock::now();
+            int rows = std::max(config.grain, 1);
+            int bands = (N + rows - 1) / rows;
+            if (bands > band_count) {
+                band_flags = std::make_unique<band_flag[]>(bands);
+                band_count = bands;
+            }
+            // Flags left by earlier waves hold smaller generations (or 0), never this one
+            int generation = ++wave;
+            workers->parallel_for(2 * bands, 1, [&](int from, int to) {
+                for (int task = from; task < to; ++task) {
+                    bool first = task == 0 || (task % 2 == 1 && (task + 1) / 2 < bands);
+                    int band = first ? (task + 1) / 2 : (task == 2 * bands - 1 ? bands - 1 : task / 2 - 1);
+                    int begin = band * rows, end = std::min(begin + rows, N);
+                    if (first) {
+                        First::run(*this, begin, end);
+                        band_flags[band].done.store(generation, std::memory_order_release);
+                        band_flags[band].done.notify_all();
+                        continue;
+                    }
+                    for (int b = std::max(band - 1, 0); b <= std::min(band + 1, bands - 1); ++b) {
+                        int seen;
+                        while ((seen = band_flags[b].done.load(std::memory_order_acquire)) != generation) {
+                            spin_then_wait(band_flags[b].done, seen, spin);
+                        }
+                    }
+                    Second::run(*this, begin, end);
+                }
+            }, config.workers, name);
+            if (auto_tune) {
+                tuners[int(phase)].report(
+                        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+        }
+
+        // Gravity and pressure as one wavefront: a band copies its old_p and gets gravity, pressure of a row
+        // touches the velocities of its neighbour rows and reads their old_p. Tuned as the pressure phase
+        void gp_wavefront() {
+            trace_span span(trace.get(), 0, "gravity + pressure");
+            run_wavefront<kernel_chain<p_snapshot<full_type>, g_mission<full_type>>, p_mission<full_type>>(
+                    tick_phase::pressure, "gravity + pressure");
+        }
+
         void g_tasks_mission() {
-            main_handler.set(&g_tasks);
-            main_handler.wait();
+            trace_span span(trace.get(), 0, phase_name(tick_phase::gravity));
+            run_phase<g_mission<full_type>>(tick_phase::gravity);
         }
 
         void p_tasks_mission() {
+            trace_span span(trace.get(), 0, phase_name(tick_phase::pressure));
             old_p = p;
-            main_handler.set(&p_tasks);
-            main_handler.wait();
+            run_phase<p_mission<full_type>>(tick_phase::pressure);
         }
 
         void flow_mission() {
-            velocity_flow.v.clear();
+            trace_span span(trace.get(), 0, phase_name(tick_phase::flow));
+            // Clears the flows of the last tick and finds this tick's edges, in parallel
+            run_phase<flow_edges_mission<full_type>>(tick_phase::flow);
+            if (solver == flow_solver::multilevel) {
+                multilevel.seed(*this);
+            }
             int cnt = 0;
             bool prop;
             do {
@@ -273,8 +616,10 @@ namespace Pepega {
                 UT += 2;
                 prop = false;
                 for (int x = 0; x < N; x++) {
+                    stream_rows(x);
                     for (int y = 0; y < M; y++) {
-                        if (field[x][y] == '#' or last_use[x][y] == UT) {
+                        // A cell without edges can't pass anything on, walls have none
+                        if (!flow_edges[x][y] or last_use[x][y] == UT) {
                             continue;
                         }
                         auto [t, _unused1, _unused2] = propagate_flow(x, y, int64_t(1));
@@ -288,17 +633,38 @@ namespace Pepega {
         }
 
         void recalculate_p() {
-            main_handler.set(&recalc_p_tasks);
-            main_handler.wait();
+            trace_span span(trace.get(), 0, phase_name(tick_phase::recalculation));
+            // p_collect of a row reads the pushes of its neighbour rows only
+            if (wavefront) {
+                run_wavefront<p_recalculation<full_type>, p_collect<full_type>>(tick_phase::recalculation,
+                                                                                phase_name(tick_phase::recalculation));
+            } else {
+                run_phase<p_recalculation<full_type>, p_collect<full_type>>(tick_phase::recalculation);
+            }
+        }
+
+        // Hash and residuals of the tick from the rows' partials, reduced in row order
+        void take_sample() {
+            sample = {};
+            sample.random_free = random_free;
+            for (int x = 0; x < N; ++x) {
+                sample.hash = hash_mix(sample.hash, row_hashes[x]);
+                sample.p_residual = std::max(sample.p_residual, row_p_residual[x]);
+                sample.v_residual = std::max(sample.v_residual, row_v_residual[x]);
+            }
         }
 
         bool apply_move_on_flow() {
             UT += 2;
             bool prop = false;
+            random_free = true;
             for (int x = 0; x < N; ++x) {
+                stream_rows(x);
                 for (int y = 0; y < M; ++y) {
                     if (field[x][y] != '#' && last_use[x][y] != UT) {
-                        if (random01<velocity_t>() < move_prob(x, y)) {
+                        auto prob = move_prob(x, y);
+                        random_free = random_free && !(prob > int64_t(0));
+                        if (random01<velocity_t>() < prob) {
                             prop = true;
                             propagate_move(x, y, true);
                         } else {
@@ -353,24 +719,48 @@ namespace Pepega {
                     }
                 }
                 */
-            g_tasks_mission();
-            p_tasks_mission();
+            // The verifier checks the state between gravity and pressure, which the wavefront never has
+            if (wavefront && !verifier) {
+                gp_wavefront();
+            } else {
+                g_tasks_mission();
+                verify(out, tick_phase::gravity);
+                p_tasks_mission();
+                verify(out, tick_phase::pressure);
+            }
             flow_mission();
+            verify(out, tick_phase::flow);
             recalculate_p();
+            verify(out, tick_phase::recalculation);
             output_handler.wait();
 
-            bool prop = apply_move_on_flow();
+            bool prop;
+            {
+                trace_span span(trace.get(), 0, phase_name(tick_phase::move));
+                prop = apply_move_on_flow();
+            }
+            verify(out, tick_phase::move);
+            if (convergence) {
+                take_sample();
+            }
 
             if (prop) {
                 last_active = out;
-                output_handler.set(&output_field_task);
+                if (field_output_enabled) {
+                    output_handler.set(&output_field_task);
+                }
+            }
+        }
+
+        void step(int first, int n) override {
+            for (int i = 0; i < n; ++i) {
+                next(first + i);
             }
         }
 
         void load(std::ifstream& file) override {
             // Helper lambda to load a 2D array from a file
             auto array_load = [&]<typename T, int N, int M>(Array<T, N, M>& arr, int n, int m) {
-                arr.init(n, m);
                 for (int i = 0; i < arr.N; ++i) {
                     for (int j = 0; j < arr.M; ++j) {
                         if constexpr (std::is_same_v<T, char>) {
@@ -390,7 +780,6 @@ namespace Pepega {
 
             // Helper lambda to load a 2D array of arrays from a file
             auto load_field = [&]<typename T, int N, int M> (Array<std::array<T, 4>, N, M>& arr, int n, int m) {
-                arr.init(n, m);
                 for (int i = 0; i < arr.N; ++i) {
                     for (int j = 0; j < arr.M; ++j) {
                         double tmp[4] = {0};
@@ -405,6 +794,7 @@ namespace Pepega {
                 throw std::invalid_argument("Something went wrong with file opening\n");
             }
             file >> N >> M >> UT;
+            allocate_grids();
             array_load(field, N, M); // Load field data
             array_load(last_use, N, M); // Load last use data
             array_load(p, N, M); // Load pressure data
@@ -413,17 +803,231 @@ namespace Pepega {
             init();
         }
 
-        friend class g_mission<full_type>;
-        friend class p_mission<full_type>;
-        friend class p_recalculation<full_type>;
+        // Same format as load(), but the file is mapped into memory and the numbers are parsed by the workers
+        void load_parallel(const std::string &path) override {
+            text_save_reader reader(path);
+            std::tie(N, M, UT) = reader.header();
+
+            allocate_grids();
+
+            reader.read_field(N, M, [&](int i, int j, char c) {
+                field[i][j] = c;
+            });
+
+            // Numbers follow in order: last_use, p, then four velocity components per cell.
+            // last_use is sized by its own Array, exactly like load() and save() do
+            size_t used = size_t(last_use.N) * last_use.M;
+            size_t cells = size_t(N) * M;
+            auto store = [&](size_t k, double tmp) {
+                if (k < used) {
+                    last_use[k / last_use.M][k % last_use.M] = tmp;
+                    return;
+                }
+                k -= used;
+                if (k < cells) {
+                    p[k / M][k % M] = tmp;
+                } else {
+                    k -= cells;
+                    velocity.v[k / 4 / M][k / 4 % M][k % 4] = v_type(tmp);
+                }
+            };
+            reader.read_numbers(*workers, 4 * workers->size(), used + 5 * cells, store);
+
+            init();
+        }
+
+        friend struct g_mission<full_type>;
+        friend struct p_snapshot<full_type>;
+        friend struct flow_edges_mission<full_type>;
+        friend struct p_mission<full_type>;
+        friend struct p_recalculation<full_type>;
+        friend struct p_collect<full_type>;
+        friend struct convergence_sample<full_type>;
         friend class field_output<full_type>;
 
         void init_workers(int n) override {
             if (n < 1) {
                 throw std::runtime_error("Must be at least 1 thread");
             }
-            main_handler.init(n);
+            if (auto_tune && placement.touch == first_touch::workers) {
+                throw std::invalid_argument("Auto-tuning can't be combined with first touch by workers");
+            }
+            main_handler.set_banded(placement.touch == first_touch::workers);
+            main_handler.set_spin(spin);
+            main_handler.init(n, worker_cpus(placement.pin, n));
+            workers = &main_handler;
+            // Field output takes long, nothing to gain from spinning on it
+            output_handler.set_spin(0);
             output_handler.init(1);
+            tuners.fill(phase_tuner(n));
+        }
+
+        void share_workers(BuddiesForeman &pool) override {
+            if (placement.touch == first_touch::workers) {
+                throw std::invalid_argument("First touch by workers needs a pool of the simulator's own");
+            }
+            if (pool.size() < 1) {
+                throw std::invalid_argument("Shared pool has no workers");
+            }
+            if (pool.size() != workers->size()) {
+                tuners.fill(phase_tuner(pool.size()));
+            }
+            workers = &pool;
+        }
+
+        void set_placement(const placement_policy &policy) override {
+            placement = policy;
+        }
+
+        void set_auto_tune(bool value) override {
+            auto_tune = value;
+        }
+
+        void set_small_grid(int cells, int rounds) override {
+            inline_cells = cells;
+            spin = rounds;
+        }
+
+        void set_wavefront(bool value) override {
+            wavefront = value;
+        }
+
+        void report_tuning(std::ostream &out) override {
+            if (!auto_tune) {
+                return;
+            }
+            for (auto phase: {tick_phase::gravity, tick_phase::pressure, tick_phase::flow, tick_phase::recalculation}) {
+                // Pipelined gravity is tuned together with pressure
+                if (phase == tick_phase::gravity && wavefront && !verifier) {
+                    continue;
+                }
+                auto &tuner = tuners[int(phase)];
+                auto config = tuner.config();
+                out << phase_name(phase) << ": " << config.workers << " workers, grain " << config.grain
+                    << (tuner.is_settled() ? "" : " (still searching)") << ", searches: " << tuner.search_count()
+                    << std::endl;
+            }
+        }
+
+        void attach_verifier(const std::string &path, bool record) override {
+            verifier = std::make_unique<replay_verifier>(path, record, N, M);
+        }
+
+        void attach_trace(const std::string &path, size_t events_per_thread) override {
+            if (workers->size() < 1) {
+                throw std::logic_error("Workers must be started before tracing");
+            }
+            trace = std::make_unique<worker_trace>(workers->size(), events_per_thread);
+            trace_path = path;
+            workers->set_trace(trace.get());
+        }
+
+        void write_trace() override {
+            if (!trace) {
+                return;
+            }
+            workers->set_trace(nullptr);
+            trace->write(trace_path);
+            trace.reset();
+        }
+
+        // Out-of-core mode: the grids live in plane files of `dir`. Returns true if the directory already
+        // holds a synced state, which is then used as it is instead of loading an input file
+        bool open_state(const std::string &dir) override {
+            if constexpr (value_N != -1) {
+                throw std::invalid_argument("State directories need a dynamic-size fluid");
+            }
+            std::filesystem::create_directories(dir);
+            state_dir = dir;
+
+            std::ifstream meta(dir + "/meta");
+            if (!(meta >> N >> M >> UT)) {
+                return false;
+            }
+            meta.close();
+            allocate_grids(true);
+            init();
+            return true;
+        }
+
+        // Writes the planes back and marks the directory as a complete state at tick UT
+        void sync_state() override {
+            if (state_dir.empty()) {
+                return;
+            }
+            field.sync();
+            last_use.sync();
+            p.sync();
+            velocity.v.sync();
+            std::ofstream meta(state_dir + "/meta", std::ios::trunc);
+            meta << N << " " << M << " " << UT << std::endl;
+        }
+
+        void set_field_output(bool value) override {
+            field_output_enabled = value;
+        }
+
+        void set_flow_solver(flow_solver value, int block) override {
+            solver = value;
+            multilevel.set_block(block);
+        }
+
+        void set_convergence(bool value) override {
+            convergence = value;
+        }
+
+        tick_sample last_sample() override {
+            return sample;
+        }
+
+        // Views straight into the grids, valid until the next tick, load or resize
+        plane_view view(state_plane plane) override {
+            auto describe = [&]<typename A>(A &arr, auto *first, int components) {
+                plane_view ret;
+                ret.data = first;
+                ret.n = N;
+                ret.m = M;
+                ret.column_stride = sizeof(arr[0][0]);
+                ret.row_stride = N > 1 ? reinterpret_cast<const char *>(&arr[1][0]) -
+                                         reinterpret_cast<const char *>(&arr[0][0]) : ret.column_stride * M;
+                ret.components = components;
+                ret.type = value_description<std::remove_cvref_t<decltype(*first)>>::get();
+                if constexpr (value_N == -1 && grid_tile != 0) {
+                    ret.tile = grid_tile;
+                    ret.padded_m = (M + grid_tile_mask) & ~grid_tile_mask;
+                } else {
+                    ret.padded_m = M;
+                }
+                return ret;
+            };
+            switch (plane) {
+                case state_plane::field:
+                    return describe(field, &field[0][0], 1);
+                case state_plane::p:
+                    return describe(p, &p[0][0], 1);
+                default:
+                    return describe(velocity.v, &velocity.v[0][0][0], int(deltas.size()));
+            }
+        }
+
+        fluid_stats stats() override {
+            fluid_stats ret;
+            ret.n = N;
+            ret.m = M;
+            ret.last_active = last_active;
+            for (int x = 0; x < N; ++x) {
+                for (int y = 0; y < M; ++y) {
+                    if (field[x][y] == '#') {
+                        continue;
+                    }
+                    ++ret.cells;
+                    ret.total_p += double(p[x][y]);
+                    for (auto v: velocity.v[x][y]) {
+                        ret.max_velocity = std::max(ret.max_velocity, std::abs(double(v)));
+                    }
+                }
+            }
+            return ret;
         }
 
         void kill_everyone() {
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "libfluid.h"
+#include "fluid.h"
+#include "flags-parser.h"
+#include "fluid-creator.h"
+
+//==============================//
+// Library state                //
+//==============================//
+
+struct fluid_sim {
+    int p_type = 0;
+    int v_type = 0;
+    int v_flow_type = 0;
+    int threads = 1;
+    long long tick = 0;
+    std::shared_ptr<Pepega::fluid_base> fluid;
+
+    ~fluid_sim() {
+        if (fluid) {
+            fluid->kill_everyone();
+        }
+    }
+};
+
+namespace {
+    thread_local std::string last_error;
+
+    // Runs f, turning an exception into -1 and the message for fluid_last_error
+    template<typename F>
+    int guarded(F &&f) {
+        try {
+            f();
+            return 0;
+        } catch (const std::exception &e) {
+            last_error = e.what();
+        } catch (...) {
+            last_error = "unknown error";
+        }
+        return -1;
+    }
+
+    Pepega::fluid_base &loaded(fluid_sim *sim) {
+        if (sim == nullptr || !sim->fluid) {
+            throw std::logic_error("No state loaded");
+        }
+        return *sim->fluid;
+    }
+}
+
+//==============================//
+// C interface                  //
+//==============================//
+
+extern "C" {
+
+int fluid_api_version(void) {
+    return FLUID_API_VERSION;
+}
+
+const char *fluid_last_error(void) {
+    return last_error.c_str();
+}
+
+fluid_sim *fluid_create(const char *p_type, const char *v_type, const char *v_flow_type, int threads) {
+    fluid_sim *sim = nullptr;
+    guarded([&] {
+        if (threads < 1) {
+            throw std::invalid_argument("Must be at least 1 thread");
+        }
+        auto created = std::make_unique<fluid_sim>();
+        created->p_type = get_type(p_type);
+        created->v_type = get_type(v_type);
+        created->v_flow_type = get_type(v_flow_type);
+        created->threads = threads;
+        sim = created.release();
+    });
+    return sim;
+}
+
+void fluid_destroy(fluid_sim *sim) {
+    delete sim;
+}
+
+void fluid_seed(unsigned seed) {
+    Pepega::rnd.seed(seed);
+}
+
+int fluid_load(fluid_sim *sim, const char *path) {
+    return guarded([&] {
+        if (sim == nullptr) {
+            throw std::invalid_argument("No simulator");
+        }
+        std::ifstream input(path);
+        int n, m;
+        if (!(input >> n >> m)) {
+            throw std::invalid_argument(std::string("Can't read ") + path);
+        }
+        input.close();
+
+        if (sim->fluid) {
+            sim->fluid->kill_everyone();
+            sim->fluid.reset();
+        }
+        auto fluid = create_fluid(sim->p_type, sim->v_type, sim->v_flow_type, n, m);
+        fluid->set_field_output(false);
+        fluid->init_workers(sim->threads);
+        try {
+            fluid->load_parallel(path);
+        } catch (...) {
+            fluid->kill_everyone();
+            throw;
+        }
+        sim->fluid = std::move(fluid);
+        sim->tick = 0;
+    });
+}
+
+int fluid_step(fluid_sim *sim, int ticks) {
+    return guarded([&] {
+        auto &fluid = loaded(sim);
+        for (int i = 0; i < ticks; ++i) {
+            fluid.next(int(sim->tick++));
+        }
+    });
+}
+
+int fluid_stats(fluid_sim *sim, fluid_stats_t *stats) {
+    return guarded([&] {
+        auto s = loaded(sim).stats();
+        stats->n = s.n;
+        stats->m = s.m;
+        stats->tick = sim->tick;
+        stats->last_active = s.last_active;
+        stats->cells = s.cells;
+        stats->total_p = s.total_p;
+        stats->max_velocity = s.max_velocity;
+    });
+}
+
+int fluid_snapshot(fluid_sim *sim, const char *path) {
+    return guarded([&] {
+        auto &fluid = loaded(sim);
+        std::ofstream out(path, std::ios::trunc);
+        fluid.save(out);
+        if (!out) {
+            throw std::runtime_error(std::string("Can't write ") + path);
+        }
+    });
+}
+
+int fluid_view(fluid_sim *sim, int plane, fluid_plane_view *view) {
+    return guarded([&] {
+        if (plane < FLUID_PLANE_FIELD || plane > FLUID_PLANE_VELOCITY) {
+            throw std::invalid_argument("Unknown plane");
+        }
+        auto v = loaded(sim).view(Pepega::state_plane(plane));
+        view->data = v.data;
+        view->n = v.n;
+        view->m = v.m;
+        view->row_stride = v.row_stride;
+        view->column_stride = v.column_stride;
+        view->components = v.components;
+        view->value_kind = int(v.type.kind);
+        view->value_size = v.type.size;
+        view->value_bits = v.type.bits;
+        view->value_frac = v.type.frac;
+        view->tile = v.tile;
+        view->padded_m = v.padded_m;
+    });
+}
+
+}
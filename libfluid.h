@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * libfluid - the simulator as a library.
+ *
+ * Plain C interface, so it stays stable across compilers and engine changes. Every call returning int
+ * gives 0 on success and -1 on failure, fluid_last_error() then describes what went wrong.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLUID_API_VERSION 1
+
+typedef struct fluid_sim fluid_sim;
+
+enum fluid_plane {
+    FLUID_PLANE_FIELD = 0,
+    FLUID_PLANE_P = 1,
+    FLUID_PLANE_VELOCITY = 2
+};
+
+enum fluid_value_kind {
+    FLUID_VALUE_CHAR = 0,
+    FLUID_VALUE_FLOAT = 1,
+    FLUID_VALUE_FIXED = 2
+};
+
+/*
+ * Read-only view of a plane, pointing into the simulator's own memory. It stays valid until the next
+ * fluid_step, fluid_load or fluid_destroy. Use fluid_view_cell to find a cell; velocity cells hold
+ * `components` values (in the order of the simulator's deltas), `value_size` bytes apart.
+ * Fixed values are raw integers with `value_frac` fractional bits out of `value_bits`.
+ */
+typedef struct {
+    const void *data;
+    int n;
+    int m;
+    ptrdiff_t row_stride;
+    ptrdiff_t column_stride;
+    int components;
+    int value_kind;
+    int value_size;
+    int value_bits;
+    int value_frac;
+    /* Non-zero if the plane is stored in tile x tile blocks, padded_m / tile blocks per block row */
+    int tile;
+    int padded_m;
+} fluid_plane_view;
+
+typedef struct {
+    int n;
+    int m;
+    /* Ticks run through fluid_step since the last fluid_load */
+    long long tick;
+    /* Last tick in which something moved */
+    long long last_active;
+    long long cells;
+    double total_p;
+    double max_velocity;
+} fluid_stats_t;
+
+int fluid_api_version(void);
+
+const char *fluid_last_error(void);
+
+/* Types are given as on the command line: "FLOAT", "DOUBLE", "FIXED(32,7)", "FAST_FIXED(52,13)" */
+fluid_sim *fluid_create(const char *p_type, const char *v_type, const char *v_flow_type, int threads);
+
+void fluid_destroy(fluid_sim *sim);
+
+/* Seeds the random generator of the calling thread, which all simulators stepped on that thread share */
+void fluid_seed(unsigned seed);
+
+/* Loads an input or save file, replacing the current state */
+int fluid_load(fluid_sim *sim, const char *path);
+
+int fluid_step(fluid_sim *sim, int ticks);
+
+int fluid_stats(fluid_sim *sim, fluid_stats_t *stats);
+
+/* Writes the state in the save format, which fluid_load and --input-file read back */
+int fluid_snapshot(fluid_sim *sim, const char *path);
+
+int fluid_view(fluid_sim *sim, int plane, fluid_plane_view *view);
+
+static inline const void *fluid_view_cell(const fluid_plane_view *view, int x, int y) {
+    const char *base = (const char *) view->data;
+    if (view->tile == 0) {
+        return base + x * view->row_stride + y * view->column_stride;
+    }
+    int t = view->tile;
+    size_t block = (size_t) (x / t) * (view->padded_m / t) + y / t;
+    size_t inside = (size_t) (x % t) * t + y % t;
+    return base + (block * t * t + inside) * view->column_stride;
+}
+
+#ifdef __cplusplus
+}
+#endif
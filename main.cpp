@@ -5,6 +5,7 @@
 #include <fstream>
 #include "fluid.h"
 #include "flags-parser.h"
+#include "fluid-creator.h"
 
 bool save_flag = false;
 bool exit_flag = false;
@@ -25,24 +26,33 @@ int main(int argc, char* argv[]) {
     parser options_parser(argc, argv);
 
     // Retrieve options for input/output files and types
-    auto input_file = options_parser.get_option("--input-file");
+    auto input_file = options_parser.get_option("--input-file", "");
     auto save_file = options_parser.get_option("--save-file");
     int p_type = get_type(options_parser.get_option("--p-type"));
     int v_type = get_type(options_parser.get_option("--v-type"));
     int v_flow_type = get_type(options_parser.get_option("--v-flow-type"));
     auto thread_count = options_parser.get_option("--threads");
+    int T = std::stoi(options_parser.get_option("--ticks", "1000000"));
+    auto state_dir = options_parser.get_option("--state-dir", "");
+
+    if (options_parser.has_option("--seed")) {
+        Pepega::rnd.seed(std::stoul(options_parser.get_option("--seed")));
+    }
 
     //==============================//
     // Work with files              //
     //==============================//
 
+    // Out-of-core runs always use the dynamic-size fluid, their size comes from the input or the saved state
     std::ifstream input(input_file);
-    if (!input.is_open()) {
-        throw std::invalid_argument("Can't open file");
+    int N = -1, M = -1;
+    if (state_dir.empty()) {
+        if (!input.is_open()) {
+            throw std::invalid_argument("Can't open file");
+        }
+        input >> N >> M;
+        input.seekg(0, std::ios::beg);
     }
-    int N, M;
-    input >> N >> M;
-    input.seekg(0, std::ios::beg);
 
     // Create the fluid simulation object
     auto fluid = create_fluid(p_type, v_type, v_flow_type, N, M);
@@ -54,14 +64,73 @@ int main(int argc, char* argv[]) {
 
     int workers = std::stoi(thread_count);
 
+    fluid->set_placement(Pepega::parse_placement(options_parser.get_option("--first-touch", "main"),
+                                                 options_parser.get_option("--pin-threads", "none"),
+                                                 options_parser.get_option("--huge-pages", "off")));
+    auto auto_tune = options_parser.get_option("--auto-tune", "off");
+    if (auto_tune != "on" && auto_tune != "off") {
+        throw std::invalid_argument("Unknown auto-tune mode: " + auto_tune);
+    }
+    fluid->set_auto_tune(auto_tune == "on");
+    auto field_output = options_parser.get_option("--field-output", "on");
+    if (field_output != "on" && field_output != "off") {
+        throw std::invalid_argument("Unknown field output mode: " + field_output);
+    }
+    fluid->set_field_output(field_output == "on");
+    fluid->set_flow_solver(Pepega::parse_flow_solver(options_parser.get_option("--flow-solver", "classic")),
+                           std::stoi(options_parser.get_option("--flow-block", "16")));
+    // Convergence monitoring: stop once the remaining ticks can't produce anything new
+    auto steady_state = options_parser.get_option("--steady-state", "off");
+    if (steady_state != "on" && steady_state != "off") {
+        throw std::invalid_argument("Unknown steady-state mode: " + steady_state);
+    }
+    Pepega::steady_monitor monitor(std::stoi(options_parser.get_option("--steady-period", "16")),
+                                   std::stod(options_parser.get_option("--steady-tolerance", "0")),
+                                   std::stoi(options_parser.get_option("--steady-window", "1000")));
+    fluid->set_convergence(steady_state == "on");
+    fluid->set_small_grid(std::stoi(options_parser.get_option("--inline-cells", "2048")),
+                          std::stoi(options_parser.get_option("--spin", "2000")));
+    auto wavefront = options_parser.get_option("--wavefront", "on");
+    if (wavefront != "on" && wavefront != "off") {
+        throw std::invalid_argument("Unknown wavefront mode: " + wavefront);
+    }
+    fluid->set_wavefront(wavefront == "on");
     fluid->init_workers(workers);
-    fluid->load(input);
+    std::cout << "Kernels: " << Pepega::kernel_target() << std::endl;
+    // A state directory holding a synced state is resumed instead of loading the input file
+    bool resumed = !state_dir.empty() && fluid->open_state(state_dir);
+    if (!resumed) {
+        if (!input.is_open()) {
+            throw std::invalid_argument("Can't open file");
+        }
+        // The stream loader is kept as a reference for the parallel one
+        if (options_parser.get_option("--loader", "parallel") == "stream") {
+            fluid->load(input);
+        } else {
+            fluid->load_parallel(input_file);
+        }
+    }
+
+    // Replay verification: record a hash stream or compare the run against one
+    if (options_parser.has_option("--hash-record") && options_parser.has_option("--hash-verify")) {
+        throw std::invalid_argument("--hash-record and --hash-verify can't be used together");
+    }
+    if (options_parser.has_option("--hash-record")) {
+        fluid->attach_verifier(options_parser.get_option("--hash-record"), true);
+    } else if (options_parser.has_option("--hash-verify")) {
+        fluid->attach_verifier(options_parser.get_option("--hash-verify"), false);
+    }
+
+    // Timeline of the phases and the workers, written when the run ends
+    if (options_parser.has_option("--trace-file")) {
+        fluid->attach_trace(options_parser.get_option("--trace-file"),
+                            std::stoull(options_parser.get_option("--trace-events", "262144")));
+    }
 
     //==============================//
     // Simulation loop              //
     //==============================//
 
-    int T = 1'000'000;
     auto timer = std::chrono::steady_clock::now();
     for (int i = 0; i < T; ++i) {
         // Check if a save has been requested
@@ -70,6 +139,7 @@ int main(int argc, char* argv[]) {
             saveFile.close();
             saveFile.open(save_file, std::ios::trunc);
             fluid->save(saveFile);
+            fluid->sync_state();
             save_flag = false;
             std::cout << "Saved to " + save_file << std::endl;
 
@@ -98,6 +168,25 @@ int main(int argc, char* argv[]) {
         //std::cout << "Tick " << i << ":\n";
         fluid->next(i);
         //if (i == 10000) break;
+
+        if (steady_state == "on") {
+            auto verdict = monitor.observe(i, fluid->last_sample());
+            if (verdict.kind == Pepega::steady_kind::cycle) {
+                // Every later tick repeats the cycle, so only the position within it at the last tick matters
+                int last = i + (T - 1 - i) % verdict.period;
+                fluid->step(i + 1, last - i);
+                std::cout << "Steady state: " << (verdict.period == 1 ? std::string("fixed point")
+                                                                      : "cycle of " + std::to_string(verdict.period)
+                                                                        + " ticks")
+                          << " at tick " << verdict.tick << ", ran " << last + 1 << " ticks, final state is that of tick "
+                          << T - 1 << std::endl;
+                break;
+            }
+            if (verdict.kind == Pepega::steady_kind::settled) {
+                std::cout << "Steady state: residuals within tolerance, stopped at tick " << verdict.tick << std::endl;
+                break;
+            }
+        }
     }
     /*
     std::cout.flush();
@@ -106,8 +195,11 @@ int main(int argc, char* argv[]) {
               << std::endl;
     */
     std::cout << "Used threads: " << thread_count << std::endl;
+    fluid->report_tuning(std::cout);
     //std::cout.flush();
-    //fluid->kill_everyone();
+    fluid->write_trace();
+    fluid->sync_state();
+    fluid->kill_everyone();
 
     // Cleanup and termination
     input.close();
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include "cpu-dispatch.h"
 #include "crutches.h"
+#include "fixed-batch.h"
+#include "replay-verifier.h"
+#include "vector-field.h"
 
 // ThreadPool взял у https://github.com/AtomicBiscuit/SE2_CPP_HW3, т.к. написать свой не успел, и прикрутил его костыльно
 // к коду дз2
@@ -13,94 +19,266 @@ public:
 };
 
 template<typename T>
-class g_mission : public Mission {
-    T *field;
-    int x;
-public:
-    g_mission(int x, T &field) : field(&field), x(x) {};
+struct g_mission {
+    // Rows [from, to), one clone per instruction set (see cpu-dispatch.h)
+    FLUID_KERNEL static void run(T &field, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            row(&field, x);
+        }
+    }
 
-    void do_this() override;
+    FLUID_KERNEL_INLINE static void row(T *field, int x);
 };
 
 template<typename T>
-void g_mission<T>::do_this() {
+void g_mission<T>::row(T *field, int x) {
+    using batch = Pepega::Batch<typename T::v_store>;
     auto G = Pepega::g<typename T::v_type>();
-    for (int y = 0; y < field->M; ++y) {
-        if (field->field[x][y] == '#')
+    if (x + 1 >= field->N)
+        return;
+    auto row = field->field[x];
+    auto below = field->field[x + 1];
+
+    // Whole batches of the row at once: the downward component (deltas[1]) gets G where both cells are open.
+    // Batches start at multiples of the lane count, so they stay contiguous in a tiled grid as well
+    auto g_batch = batch::broadcast(G);
+    int y = 0;
+    for (; y + batch::lanes <= field->M; y += batch::lanes) {
+        const char *open_row = &row[y];
+        const char *open_below = &below[y];
+        typename batch::mask_t open;
+        for (int i = 0; i < batch::lanes; ++i) {
+            open[i] = -(open_row[i] != '#' && open_below[i] != '#');
+        }
+        auto *down = &field->velocity.template get<1>(x, y);
+        auto v = batch::load(down, 4);
+        select(open, v + g_batch, v).store(down, 4);
+    }
+    for (; y < field->M; ++y) {
+        if (row[y] == '#')
             continue;
-        if (field->field[x + 1][y] != '#')
-            field->velocity.add(x, y, 1, 0, G);
+        if (below[y] != '#')
+            field->velocity.template add<1>(x, y, G);
     }
 }
 
+// Kernels run one after another on the same rows, as one kernel
+template<typename... Kernels>
+struct kernel_chain {
+    template<typename T>
+    static void run(T &f, int from, int to) {
+        (Kernels::run(f, from, to), ...);
+    }
+};
+
+// old_p of rows [from, to): the pressures p_mission compares, taken band by band when the phase is pipelined
 template<typename T>
-class p_mission : public Mission {
-    T *f;
-    int x;
-public:
-    p_mission(int x, T &field) : f(&field), x(x) {};
+struct p_snapshot {
+    static void run(T &f, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            for (int y = 0; y < f.M; ++y) {
+                f.old_p[x][y] = f.p[x][y];
+            }
+        }
+    }
+};
 
-    void do_this() override;
+template<typename T>
+struct p_mission {
+    FLUID_KERNEL static void run(T &f, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            row(&f, x);
+        }
+    }
+
+    FLUID_KERNEL_INLINE static void row(T *f, int x);
 };
 
+// Row x also writes velocities of the rows x - 1 and x + 1, yet two workers never touch the same entry: the edge
+// between two cells is handled only by the cell with the strictly higher old_p, and both velocity slots of the
+// edge (its own towards the neighbour, the neighbour's back towards it) are written only there. Every edge has
+// one owner whatever the rows are split into, so the phase needs no locks and gives the serial result
 template<typename T>
-void p_mission<T>::do_this() {
+void p_mission<T>::row(T *f, int x) {
     for (int y = 0; y < f->M; ++y) {
         if (f->field[x][y] == '#')
             continue;
-        for (auto [dx, dy]: Pepega::deltas) {
+        Pepega::for_each_dir([&]<int Dir>() {
+            constexpr auto dx = Pepega::deltas[Dir].first, dy = Pepega::deltas[Dir].second;
             int nx = x + dx, ny = y + dy;
             if (f->field[nx][ny] == '#' or f->old_p[nx][ny] >= f->old_p[x][y]) {
-                continue;
+                return;
             }
             auto force = f->old_p[x][y] - f->old_p[nx][ny];
-            auto &contr = f->velocity.get(nx, ny, -dx, -dy);
-            const auto &tmp = typename T::p_type(contr) * f->rho[(int) f->field[nx][ny]];
+            auto &contr = f->velocity.template get<Pepega::opposite<Dir>>(nx, ny);
+            const auto &tmp = typename T::p_type(Pepega::widen(contr)) * f->rho[(int) f->field[nx][ny]];
             if (tmp >= force) {
                 contr -= typename T::v_type(force / f->rho[(int) f->field[nx][ny]]);
-                continue;
+                return;
             }
             force -= tmp;
             contr = int64_t(0);
-            f->velocity.add(x, y, dx, dy, typename T::v_type(force / f->rho[(int) f->field[x][y]]));
+            f->velocity.template add<Dir>(x, y, typename T::v_type(force / f->rho[(int) f->field[x][y]]));
             f->p[x][y] -= force / f->dirs[x][y];
-        }
+        });
     }
 }
 
+// Start of the flow phase for one row: zeroes the velocity_flow slots the previous tick could have written
+// (the cell's old flow_edges) and marks the edges propagate_flow can use this tick. An edge left out has a
+// flow of 0 and a capacity within 0.0001 of it, which propagate_flow would skip anyway, so the search
+// gives the same result
+template<typename T>
+struct flow_edges_mission {
+    static void run(T &f, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            row(&f, x);
+        }
+    }
+
+    static void row(T *f, int x);
+};
 
 template<typename T>
-class p_recalculation : public Mission {
-    T *f;
-    int x;
-public:
-    p_recalculation(int x, T &field) : f(&field), x(x) {};
+void flow_edges_mission<T>::row(T *f, int x) {
+    using vf_type = typename T::vf_type;
+    for (int y = 0; y < f->M; ++y) {
+        auto &edges = f->flow_edges[x][y];
+        auto &flow = f->velocity_flow.v[x][y];
+        for (size_t i = 0; i < flow.size(); ++i) {
+            if (edges >> i & 1) {
+                flow[i] = vf_type(int64_t(0));
+            }
+        }
+        edges = 0;
+        if (f->field[x][y] == '#')
+            continue;
+        Pepega::for_each_dir([&]<int Dir>() {
+            constexpr auto dx = Pepega::deltas[Dir].first, dy = Pepega::deltas[Dir].second;
+            int nx = x + dx, ny = y + dy;
+            if (nx < 0 || nx >= f->N || ny < 0 || ny >= f->M || f->field[nx][ny] == '#')
+                return;
+            auto cap = vf_type(Pepega::widen(f->velocity.template get<Dir>(x, y)));
+            if (!(fabs(vf_type(int64_t(0)) - cap) <= 0.0001)) {
+                edges |= 1 << Dir;
+            }
+        });
+    }
+}
 
-    void do_this() override;
+// Recalculation in two passes, so that every cell of p is written by one worker only. p_recalculation updates
+// the velocities of a row and records the pressure each cell gives away and to whom; p_collect then adds to
+// every cell what it was given, in the order the serial sweep would have added it, so the sums are the same
+// bit for bit with floating types too
+template<typename T>
+struct p_recalculation {
+    FLUID_KERNEL static void run(T &f, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            row(&f, x);
+        }
+    }
+
+    FLUID_KERNEL_INLINE static void row(T *f, int x);
 };
 
 template<typename T>
-void p_recalculation<T>::do_this() {
+void p_recalculation<T>::row(T *f, int x) {
     for (int y = 0; y < f->M; ++y) {
         if (f->field[x][y] == '#')
             continue;
-        for (auto [dx, dy]: Pepega::deltas) {
-            auto &old_v = f->velocity.get(x, y, dx, dy);
-            const auto &new_v = f->velocity_flow.get(x, y, dx, dy);
+        auto &push = f->pushes[x][y];
+        push.mask = 0;
+        Pepega::for_each_dir([&]<int Dir>() {
+            constexpr auto dx = Pepega::deltas[Dir].first, dy = Pepega::deltas[Dir].second;
+            auto &old_v = f->velocity.template get<Dir>(x, y);
+            const auto &new_v = f->velocity_flow.template get<Dir>(x, y);
             if (old_v > int64_t(0)) {
                 //assert(typename T::v_type(new_v) <= old_v);
-                auto force = typename T::p_type(old_v - typename T::v_type(new_v)) * f->rho[(int) f->field[x][y]];
-                old_v = typename T::v_type(new_v);
+                auto force = typename T::p_type(old_v - typename T::v_type(Pepega::widen(new_v))) * f->rho[(int) f->field[x][y]];
+                old_v = typename T::v_type(Pepega::widen(new_v));
                 if (f->field[x][y] == '.')
                     force *= 0.8;
+                // Goes to the cell itself if the neighbour is a wall
                 if (f->field[x + dx][y + dy] == '#') {
-                    f->update_p(x, y, force / f->dirs[x][y]);
+                    push.value[Dir] = force / f->dirs[x][y];
                 } else {
-                    f->update_p(x + dx, y + dy, force / f->dirs[x + dx][y + dy]);
+                    push.value[Dir] = force / f->dirs[x + dx][y + dy];
                 }
+                push.mask |= 1 << Dir;
             }
+        });
+        f->update_move_table(x, y);
+    }
+}
+
+// Hash and largest changes of p and velocity over the tick for one row, taken by p_collect once the row is done;
+// saves the velocity for the next tick
+template<typename T>
+struct convergence_sample {
+    static void row(T *f, int x);
+};
+
+template<typename T>
+struct p_collect {
+    FLUID_KERNEL static void run(T &f, int from, int to) {
+        for (int x = from; x < to; ++x) {
+            row(&f, x);
+        }
+    }
+
+    FLUID_KERNEL_INLINE static void row(T *f, int x);
+};
+
+template<typename T>
+void p_collect<T>::row(T *f, int x) {
+    // Slots by deltas: 0 up, 1 down, 2 left, 3 right. A neighbour gives to (x, y) through the slot pointing back
+    // at it, and the serial sweep visits the givers row by row: up, left, the cell itself, right, down
+    for (int y = 0; y < f->M; ++y) {
+        if (f->field[x][y] == '#')
+            continue;
+        auto &p = f->p[x][y];
+        auto add = [&](int sx, int sy, int dir) {
+            const auto &push = f->pushes[sx][sy];
+            if (push.mask >> dir & 1) {
+                p += push.value[dir];
+            }
+        };
+        add(x - 1, y, 1);
+        add(x, y - 1, 3);
+        Pepega::for_each_dir([&]<int Dir>() {
+            constexpr auto dx = Pepega::deltas[Dir].first, dy = Pepega::deltas[Dir].second;
+            if (f->field[x + dx][y + dy] == '#') {
+                add(x, y, Dir);
+            }
+        });
+        add(x, y + 1, 2);
+        add(x + 1, y, 0);
+    }
+    // p and velocity of the row are final for the tick but for the move phase
+    if (f->convergence) {
+        convergence_sample<T>::row(f, x);
+    }
+}
+
+template<typename T>
+void convergence_sample<T>::row(T *f, int x) {
+    uint64_t hash = 0;
+    double dp = 0, dv = 0;
+    for (int y = 0; y < f->M; ++y) {
+        uint64_t cell = Pepega::hash_mix(Pepega::hash_bits(f->field[x][y]), Pepega::hash_bits(f->p[x][y]));
+        dp = std::max(dp, std::abs(double(f->p[x][y] - f->old_p[x][y])));
+        auto &previous = f->previous_velocity.v[x][y];
+        const auto &current = f->velocity.v[x][y];
+        for (size_t i = 0; i < current.size(); ++i) {
+            cell = Pepega::hash_mix(cell, Pepega::hash_bits(current[i]));
+            dv = std::max(dv, std::abs(double(current[i] - previous[i])));
+            previous[i] = current[i];
         }
+        hash = Pepega::hash_mix(hash, cell);
     }
+    f->row_hashes[x] = hash;
+    f->row_p_residual[x] = dp;
+    f->row_v_residual[x] = dv;
 }
 
 template<typename T>
@@ -0,0 +1,339 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "fixed.h"
+#include "vector-field.h"
+
+namespace Pepega {
+
+    //==============================//
+    // Flow solvers                 //
+    //==============================//
+
+    // classic: unit pushes along cycles found cell by cell (fluid::propagate_flow) from an empty flow.
+    // multilevel: the same finish, started from a flow the coarse grid of blocks found (multilevel_flow)
+    enum class flow_solver {
+        classic,
+        multilevel
+    };
+
+    inline flow_solver parse_flow_solver(const std::string &name) {
+        if (name == "classic") {
+            return flow_solver::classic;
+        }
+        if (name == "multilevel") {
+            return flow_solver::multilevel;
+        }
+        throw std::invalid_argument("Unknown flow solver: " + name);
+    }
+
+    //==============================//
+    // Coarse-to-fine flow start    //
+    //==============================//
+
+    // Builds a feasible initial circulation for the flow phase in three steps:
+    // 1. the capacities (velocity) of the edges crossing between blocks of `block` x `block` cells are summed
+    //    into a coarse grid of blocks and netted: what two blocks exchange both ways is local back-and-forth
+    //    the fine finish takes care of, only the net transfer is large-scale circulation;
+    // 2. cycles are cancelled on the coarse grid with whole-bottleneck pushes;
+    // 3. every coarse cycle is projected back as closed walks of fine cells through its corridor of blocks,
+    //    found by a breadth-first search that must visit the blocks in the cycle's order.
+    // Step 3 only pushes what fine residuals allow, so the flow never exceeds velocity and stays a circulation;
+    // the classic sweeps then finish it with local augmentations. The classic solver moves a long circulation
+    // one unit per trip around the whole loop; the coarse grid routes it in a few bottleneck pushes instead
+    template<typename T>
+    class multilevel_flow {
+        using vf_t = typename T::vf_type;
+        static constexpr double eps = 0.0001;
+        // Failed walk searches after which a coarse cycle is given up, bounds the work spent on blocked corridors
+        static constexpr int max_misses = 2;
+
+        int block = 16;
+        int bn = 0, bm = 0;
+        // Residual capacity of the coarse edges by deltas slot
+        std::vector<std::array<double, deltas.size()>> coarse;
+        // Cycles of the coarse solve: blocks in order (into cycle_blocks) and the amount pushed along them
+        struct coarse_cycle {
+            int first;
+            int length;
+            double amount;
+        };
+        std::vector<coarse_cycle> cycles;
+        std::vector<int> cycle_blocks;
+        // Coarse search: 0 unvisited, 1 on the stack, 2 can't reach a cycle any more
+        std::vector<uint8_t> color;
+        std::vector<uint8_t> next_dir;
+        std::vector<int> stack;
+        // Fine search, states are (stage, cell of the stage's block)
+        std::vector<int> stage_of;
+        std::vector<int> parent;
+        std::vector<int> queue;
+        std::vector<int64_t> walk;
+
+        static vf_t residual(T &f, int x, int y, int dir) {
+            auto cap = vf_t(widen(f.velocity.v[x][y][dir]));
+            auto flow = widen(f.velocity_flow.v[x][y][dir]);
+            if (fabs(flow - cap) <= 0.0001) {
+                return vf_t(int64_t(0));
+            }
+            return cap - flow;
+        }
+
+        int block_of(int x, int y) const {
+            return x / block * bm + y / block;
+        }
+
+        // Adds the capacity of edge (x, y) -> slot dir to its coarse edge if it crosses into another block
+        void add_crossing(T &f, int x, int y, int dir) {
+            int nx = x + deltas[dir].first, ny = y + deltas[dir].second;
+            if (f.field[x][y] == '#' || f.field[nx][ny] == '#') {
+                return;
+            }
+            auto r = residual(f, x, y, dir);
+            if (r > int64_t(0)) {
+                coarse[block_of(x, y)][dir] += double(r);
+            }
+        }
+
+        void build_coarse(T &f) {
+            bn = (f.N + block - 1) / block;
+            bm = (f.M + block - 1) / block;
+            coarse.assign(size_t(bn) * bm, {});
+            // Only the rows and columns on both sides of a block border have crossing edges (slots by deltas:
+            // 0 up, 1 down, 2 left, 3 right)
+            for (int x = block; x < f.N; x += block) {
+                for (int y = 0; y < f.M; ++y) {
+                    add_crossing(f, x - 1, y, 1);
+                    add_crossing(f, x, y, 0);
+                }
+            }
+            for (int x = 0; x < f.N; ++x) {
+                for (int y = block; y < f.M; y += block) {
+                    add_crossing(f, x, y - 1, 3);
+                    add_crossing(f, x, y, 2);
+                }
+            }
+            for (int b = 0; b < int(coarse.size()); ++b) {
+                for (int dir: {1, 3}) {
+                    int v = coarse_neighbour(b, dir);
+                    if (v >= 0) {
+                        double both = std::min(coarse[b][dir], coarse[v][dir ^ 1]);
+                        coarse[b][dir] -= both;
+                        coarse[v][dir ^ 1] -= both;
+                    }
+                }
+            }
+        }
+
+        int coarse_neighbour(int b, int dir) const {
+            int bx = b / bm + deltas[dir].first, by = b % bm + deltas[dir].second;
+            if (bx < 0 || bx >= bn || by < 0 || by >= bm) {
+                return -1;
+            }
+            return bx * bm + by;
+        }
+
+        // Depth-first search from `root` for a cycle of coarse edges with residual; pushes its bottleneck
+        bool cancel_cycle(int root) {
+            if (color[root] == 2) {
+                return false;
+            }
+            stack.assign(1, root);
+            color[root] = 1;
+            next_dir[root] = 0;
+            while (!stack.empty()) {
+                int u = stack.back();
+                if (next_dir[u] == deltas.size()) {
+                    color[u] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                int dir = next_dir[u]++;
+                int v = coarse_neighbour(u, dir);
+                if (v < 0 || coarse[u][dir] <= eps || color[v] == 2) {
+                    continue;
+                }
+                if (color[v] == 0) {
+                    color[v] = 1;
+                    next_dir[v] = 0;
+                    stack.push_back(v);
+                    continue;
+                }
+
+                // v is on the stack: the cycle is v .. u, v, every block left through slot next_dir - 1
+                size_t from = std::find(stack.begin(), stack.end(), v) - stack.begin();
+                double amount = coarse[u][dir];
+                for (size_t i = from; i + 1 < stack.size(); ++i) {
+                    amount = std::min(amount, coarse[stack[i]][next_dir[stack[i]] - 1]);
+                }
+                cycles.push_back({int(cycle_blocks.size()), int(stack.size() - from), amount});
+                for (size_t i = from; i < stack.size(); ++i) {
+                    coarse[stack[i]][next_dir[stack[i]] - 1] -= amount;
+                    cycle_blocks.push_back(stack[i]);
+                }
+                for (int b: stack) {
+                    color[b] = 0;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        void solve_coarse() {
+            cycles.clear();
+            cycle_blocks.clear();
+            color.assign(coarse.size(), 0);
+            next_dir.assign(coarse.size(), 0);
+            for (int b = 0; b < int(coarse.size()); ++b) {
+                while (cancel_cycle(b)) {
+                }
+            }
+        }
+
+        // Breadth-first search for a closed walk from (x, y) in the first block of `c` through the cycle's
+        // blocks in order and back; stage k is the k-th block, stage length is the first block again
+        bool find_walk(T &f, const coarse_cycle &c, int sx, int sy) {
+            int area = block * block;
+            int stages = c.length + 1;
+            parent.assign(size_t(stages) * area, -1);
+            auto state = [&](int stage, int x, int y) {
+                return stage * area + x % block * block + y % block;
+            };
+            auto cell = [&](int s) {
+                int b = cycle_blocks[c.first + s / area % c.length];
+                int local = s % area;
+                return std::pair(b / bm * block + local / block, b % bm * block + local % block);
+            };
+
+            int start = state(0, sx, sy), target = state(c.length, sx, sy);
+            parent[start] = -2;
+            queue.assign(1, start);
+            for (size_t head = 0; head < queue.size(); ++head) {
+                int s = queue[head];
+                int stage = s / area;
+                auto [x, y] = cell(s);
+                for (int dir = 0; dir < int(deltas.size()); ++dir) {
+                    int nx = x + deltas[dir].first, ny = y + deltas[dir].second;
+                    if (f.field[nx][ny] == '#' || !(residual(f, x, y, dir) > int64_t(0))) {
+                        continue;
+                    }
+                    int k = stage_of[block_of(nx, ny)];
+                    int next_stage;
+                    if (k == stage % c.length) {
+                        next_stage = stage;
+                    } else if (stage < c.length && k == (stage + 1) % c.length) {
+                        next_stage = stage + 1;
+                    } else {
+                        continue;
+                    }
+                    int n = state(next_stage, nx, ny);
+                    if (parent[n] != -1) {
+                        continue;
+                    }
+                    parent[n] = s * int(deltas.size()) + dir;
+                    if (n == target) {
+                        return true;
+                    }
+                    queue.push_back(n);
+                }
+            }
+            return false;
+        }
+
+        // Pushes up to `limit` along the walk find_walk ended at, returns the amount
+        double push_walk(T &f, const coarse_cycle &c, int sx, int sy, double limit) {
+            int area = block * block;
+            walk.clear();
+            for (int s = c.length * area + sx % block * block + sy % block; parent[s] != -2;) {
+                int from = parent[s] / int(deltas.size()), dir = parent[s] % int(deltas.size());
+                int b = cycle_blocks[c.first + from / area % c.length];
+                int local = from % area;
+                int x = b / bm * block + local / block, y = b % bm * block + local % block;
+                walk.push_back((int64_t(x) * f.M + y) * int64_t(deltas.size()) + dir);
+                s = from;
+            }
+            // A walk may pass an edge of the first block twice, once on the way out and once on the way back
+            std::sort(walk.begin(), walk.end());
+            double amount = limit;
+            for (size_t i = 0; i < walk.size();) {
+                size_t j = i;
+                while (j < walk.size() && walk[j] == walk[i]) {
+                    ++j;
+                }
+                int64_t cell = walk[i] / int64_t(deltas.size());
+                auto r = residual(f, int(cell / f.M), int(cell % f.M), int(walk[i] % int64_t(deltas.size())));
+                amount = std::min(amount, double(r) / double(j - i));
+                i = j;
+            }
+            auto step = vf_t(amount);
+            if (!(step > int64_t(0))) {
+                return 0;
+            }
+            for (auto e: walk) {
+                int64_t cell = e / int64_t(deltas.size());
+                f.velocity_flow.v[int(cell / f.M)][int(cell % f.M)][int(e % int64_t(deltas.size()))] += step;
+            }
+            return double(step);
+        }
+
+        void project(T &f, const coarse_cycle &c) {
+            for (int i = 0; i < c.length; ++i) {
+                stage_of[cycle_blocks[c.first + i]] = i;
+            }
+            int b0 = cycle_blocks[c.first], b1 = cycle_blocks[c.first + 1];
+            int x0 = b0 / bm * block, y0 = b0 % bm * block;
+            double left = c.amount;
+            int misses = 0;
+            // Walks start at the cells of the first block with an open edge into the second one
+            for (int x = x0; x < std::min(x0 + block, f.N) && left > eps && misses < max_misses; ++x) {
+                for (int y = y0; y < std::min(y0 + block, f.M) && left > eps && misses < max_misses; ++y) {
+                    if (f.field[x][y] == '#') {
+                        continue;
+                    }
+                    for (int dir = 0; dir < int(deltas.size()) && left > eps && misses < max_misses; ++dir) {
+                        int nx = x + deltas[dir].first, ny = y + deltas[dir].second;
+                        if (f.field[nx][ny] == '#' || block_of(nx, ny) != b1 ||
+                            !(residual(f, x, y, dir) > int64_t(0))) {
+                            continue;
+                        }
+                        while (left > eps && find_walk(f, c, x, y)) {
+                            double pushed = push_walk(f, c, x, y, left);
+                            if (pushed <= 0) {
+                                break;
+                            }
+                            left -= pushed;
+                        }
+                        misses += left > eps;
+                    }
+                }
+            }
+            for (int i = 0; i < c.length; ++i) {
+                stage_of[cycle_blocks[c.first + i]] = -1;
+            }
+        }
+
+    public:
+        void set_block(int value) {
+            if (value < 2) {
+                throw std::invalid_argument("Flow block must be at least 2 cells");
+            }
+            block = value;
+        }
+
+        // Adds the projected coarse circulation to velocity_flow, which the caller has cleared
+        void seed(T &f) {
+            build_coarse(f);
+            solve_coarse();
+            stage_of.assign(coarse.size(), -1);
+            for (const auto &c: cycles) {
+                project(f, c);
+            }
+        }
+    };
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Pepega {
+
+    //==============================//
+    // Placement policies           //
+    //==============================//
+
+    // Who writes the grid pages first (and therefore which NUMA node they live on)
+    enum class first_touch {
+        main,
+        workers
+    };
+
+    // How pool workers are bound to CPUs
+    enum class pinning {
+        none,
+        compact,
+        scatter
+    };
+
+    struct placement_policy {
+        first_touch touch = first_touch::main;
+        pinning pin = pinning::none;
+        bool huge_pages = false;
+    };
+
+    inline placement_policy parse_placement(const std::string &touch, const std::string &pin, const std::string &huge) {
+        placement_policy policy;
+        if (touch == "workers") {
+            policy.touch = first_touch::workers;
+        } else if (touch != "main") {
+            throw std::invalid_argument("Unknown first touch policy: " + touch);
+        }
+        if (pin == "compact") {
+            policy.pin = pinning::compact;
+        } else if (pin == "scatter") {
+            policy.pin = pinning::scatter;
+        } else if (pin != "none") {
+            throw std::invalid_argument("Unknown pinning policy: " + pin);
+        }
+        if (huge == "on") {
+            policy.huge_pages = true;
+        } else if (huge != "off") {
+            throw std::invalid_argument("Unknown huge pages mode: " + huge);
+        }
+        return policy;
+    }
+
+    //==============================//
+    // CPU affinity                 //
+    //==============================//
+
+    // Parses a kernel cpu list such as "0-3,8,10-11"
+    inline std::vector<int> parse_cpu_list(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string part;
+        while (std::getline(ss, part, ',')) {
+            if (part.empty()) {
+                continue;
+            }
+            auto dash = part.find('-');
+            int from = std::stoi(part.substr(0, dash));
+            int to = dash == std::string::npos ? from : std::stoi(part.substr(dash + 1));
+            for (int cpu = from; cpu <= to; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    // CPUs for n workers: compact fills one socket first, scatter alternates between NUMA nodes
+    inline std::vector<int> worker_cpus(pinning pin, int n) {
+        std::vector<int> result;
+#ifdef __linux__
+        if (pin == pinning::none) {
+            return result;
+        }
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return result;
+        }
+
+        std::vector<std::vector<int>> nodes;
+        if (pin == pinning::scatter) {
+            for (int node = 0;; ++node) {
+                std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                if (!in.is_open()) {
+                    break;
+                }
+                std::string list;
+                std::getline(in, list);
+                std::vector<int> listed;
+                try {
+                    listed = parse_cpu_list(list);
+                } catch (const std::logic_error &) {
+                    // Not a cpu list: leaves its CPUs uncovered, see below
+                }
+                std::vector<int> cpus;
+                for (int cpu: listed) {
+                    if (CPU_ISSET(cpu, &allowed)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+                if (!cpus.empty()) {
+                    nodes.push_back(std::move(cpus));
+                }
+            }
+            // A partial or unreadable sysfs leaves allowed CPUs out of every node, scattering over the nodes
+            // would then skip them: such a machine gets the flat list
+            cpu_set_t covered;
+            CPU_ZERO(&covered);
+            for (auto &cpus: nodes) {
+                for (int cpu: cpus) {
+                    CPU_SET(cpu, &covered);
+                }
+            }
+            if (CPU_COUNT(&covered) != CPU_COUNT(&allowed)) {
+                nodes.clear();
+            }
+        }
+        if (nodes.empty()) {
+            nodes.emplace_back();
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    nodes.back().push_back(cpu);
+                }
+            }
+        }
+
+        size_t longest = 0;
+        for (auto &cpus: nodes) {
+            longest = std::max(longest, cpus.size());
+        }
+        std::vector<int> order;
+        for (size_t i = 0; i < longest; ++i) {
+            for (auto &cpus: nodes) {
+                if (i < cpus.size()) {
+                    order.push_back(cpus[i]);
+                }
+            }
+        }
+        for (int i = 0; i < n && !order.empty(); ++i) {
+            result.push_back(order[i % order.size()]);
+        }
+#endif
+        return result;
+    }
+
+    inline void pin_thread(std::thread &thread, int cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+    //==============================//
+    // Grid memory                  //
+    //==============================//
+
+    constexpr size_t huge_page_size = size_t(2) << 20;
+
+    inline size_t grid_mapping_size(size_t bytes, bool huge_pages) {
+        size_t align = huge_pages ? huge_page_size : 4096;
+        return (bytes + align - 1) / align * align;
+    }
+
+    // Anonymous mapping for a grid. Its pages stay untouched (and unplaced) until the first write,
+    // with huge_pages the region is 2 MiB aligned and marked for transparent huge pages
+    inline void *map_grid(size_t bytes, bool huge_pages) {
+        size_t length = grid_mapping_size(bytes, huge_pages);
+        if (length == 0) {
+            return nullptr;
+        }
+        size_t extra = huge_pages ? huge_page_size : 0;
+        void *raw = ::mmap(nullptr, length + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        if (!huge_pages) {
+            return raw;
+        }
+
+        auto begin = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = (begin + huge_page_size - 1) / huge_page_size * huge_page_size;
+        if (aligned > begin) {
+            ::munmap(raw, aligned - begin);
+        }
+        if (begin + extra > aligned) {
+            ::munmap(reinterpret_cast<void *>(aligned + length), begin + extra - aligned);
+        }
+#ifdef MADV_HUGEPAGE
+        ::madvise(reinterpret_cast<void *>(aligned), length, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    inline void unmap_grid(void *ptr, size_t bytes, bool huge_pages) {
+        if (ptr != nullptr) {
+            ::munmap(ptr, grid_mapping_size(bytes, huge_pages));
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Pepega {
+
+    //==============================//
+    // Plane files                  //
+    //==============================//
+
+    // One grid plane on disk: a page-sized header followed by the raw cells in the grid's memory layout
+    struct plane_header {
+        char magic[8] = "FLPLANE";
+        int32_t n = 0;
+        int32_t m = 0;
+        int32_t cell_size = 0;
+        int32_t tile = 0;
+    };
+
+    constexpr size_t plane_data_offset = 4096;
+
+    struct plane_mapping {
+        void *base = nullptr;
+        size_t length = 0;
+        bool reused = false;
+
+        void *data() const {
+            return static_cast<char *>(base) + plane_data_offset;
+        }
+    };
+
+    // Maps `path` shared and writable. A file with the same header keeps its contents (reused = true),
+    // anything else is replaced by a sparse zero-filled plane. The kernel pages the cells in and writes
+    // them back on its own, so the plane can be larger than memory
+    inline plane_mapping map_plane(const std::string &path, const plane_header &header, size_t bytes) {
+        plane_mapping mapping;
+        mapping.length = plane_data_offset + bytes;
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Can't open plane file " + path);
+        }
+        plane_header existing;
+        struct stat st{};
+        bool matches = ::fstat(fd, &st) == 0 && size_t(st.st_size) == mapping.length &&
+                       ::pread(fd, &existing, sizeof(existing), 0) == sizeof(existing) &&
+                       std::memcmp(&existing, &header, sizeof(header)) == 0;
+        if (!matches) {
+            if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, mapping.length) != 0 ||
+                ::pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+                ::close(fd);
+                throw std::runtime_error("Can't create plane file " + path);
+            }
+        }
+
+        void *ptr = ::mmap(nullptr, mapping.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("Can't map plane file " + path);
+        }
+        ::madvise(ptr, mapping.length, MADV_SEQUENTIAL);
+        mapping.base = ptr;
+        mapping.reused = matches;
+        return mapping;
+    }
+
+    inline void sync_plane(const plane_mapping &mapping) {
+        if (mapping.base != nullptr) {
+            ::msync(mapping.base, mapping.length, MS_SYNC);
+        }
+    }
+
+    inline void unmap_plane(plane_mapping &mapping) {
+        if (mapping.base != nullptr) {
+            ::munmap(mapping.base, mapping.length);
+            mapping.base = nullptr;
+        }
+    }
+
+    // Asks the kernel to start reading [from, to) of a plane ahead of the sweep
+    inline void prefetch_plane(const void *from, const void *to) {
+        auto begin = reinterpret_cast<uintptr_t>(from) & ~uintptr_t(4095);
+        auto end = reinterpret_cast<uintptr_t>(to);
+        if (end > begin) {
+            ::madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Pepega {
+
+    //==============================//
+    // Tick phases                  //
+    //==============================//
+
+    // Phases of a single tick, in the order fluid::next runs them
+    enum class tick_phase : uint8_t {
+        gravity,
+        pressure,
+        flow,
+        recalculation,
+        move
+    };
+
+    inline const char *phase_name(tick_phase phase) {
+        switch (phase) {
+            case tick_phase::gravity:
+                return "gravity";
+            case tick_phase::pressure:
+                return "pressure";
+            case tick_phase::flow:
+                return "flow";
+            case tick_phase::recalculation:
+                return "recalculation";
+            default:
+                return "move";
+        }
+    }
+
+    //==============================//
+    // State hashing                //
+    //==============================//
+
+    // Cheap 64-bit mixer (splitmix64 finalizer), good enough to detect any bit flip in the state
+    inline uint64_t hash_mix(uint64_t h, uint64_t v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+
+    // Raw bits of a simulation value: Fixed is hashed by its raw integer, floating types by their bit pattern
+    template<typename T>
+    uint64_t hash_bits(const T &x) {
+        if constexpr (std::is_same_v<T, float>) {
+            return std::bit_cast<uint32_t>(x);
+        } else if constexpr (std::is_same_v<T, double>) {
+            return std::bit_cast<uint64_t>(x);
+        } else if constexpr (std::is_integral_v<T>) {
+            return static_cast<uint64_t>(x);
+        } else {
+            return static_cast<uint64_t>(x.v);
+        }
+    }
+
+    // Hashes of the whole state plus one hash per row and per column, so a mismatch can be localized
+    struct state_hashes {
+        uint64_t total = 0;
+        std::vector<uint32_t> rows;
+        std::vector<uint32_t> cols;
+    };
+
+    //==============================//
+    // Replay verifier              //
+    //==============================//
+
+    // Writes (record mode) or compares (verify mode) a stream of per-phase state hashes.
+    // Stream layout: "FLHASH1" magic, N, M, then for every checked phase:
+    // tick (int32), phase (uint8), total (uint64), rows[N] (uint32), cols[M] (uint32)
+    class replay_verifier {
+    public:
+        replay_verifier(const std::string &path, bool record, int n, int m) : record(record), N(n), M(m) {
+            if (record) {
+                out.open(path, std::ios::binary | std::ios::trunc);
+                if (!out.is_open()) {
+                    throw std::invalid_argument("Can't open hash file " + path);
+                }
+                out.write(magic, sizeof(magic));
+                write(N);
+                write(M);
+                return;
+            }
+
+            in.open(path, std::ios::binary);
+            if (!in.is_open()) {
+                throw std::invalid_argument("Can't open hash file " + path);
+            }
+            char got[sizeof(magic)];
+            int ref_n = 0, ref_m = 0;
+            in.read(got, sizeof(got));
+            read(ref_n);
+            read(ref_m);
+            if (!in || std::memcmp(got, magic, sizeof(magic)) != 0) {
+                throw std::invalid_argument("Not a hash stream: " + path);
+            }
+            if (ref_n != N || ref_m != M) {
+                throw std::invalid_argument("Hash stream was recorded for another field size");
+            }
+        }
+
+        void check(int tick, tick_phase phase, const state_hashes &h) {
+            if (record) {
+                write(static_cast<int32_t>(tick));
+                write(static_cast<uint8_t>(phase));
+                write(h.total);
+                out.write(reinterpret_cast<const char *>(h.rows.data()), h.rows.size() * sizeof(uint32_t));
+                out.write(reinterpret_cast<const char *>(h.cols.data()), h.cols.size() * sizeof(uint32_t));
+                return;
+            }
+            if (finished) {
+                return;
+            }
+
+            int32_t ref_tick = 0;
+            uint8_t ref_phase = 0;
+            uint64_t ref_total = 0;
+            std::vector<uint32_t> ref_rows(N), ref_cols(M);
+            read(ref_tick);
+            read(ref_phase);
+            read(ref_total);
+            in.read(reinterpret_cast<char *>(ref_rows.data()), ref_rows.size() * sizeof(uint32_t));
+            in.read(reinterpret_cast<char *>(ref_cols.data()), ref_cols.size() * sizeof(uint32_t));
+            if (!in) {
+                finished = true;
+                std::cerr << "Hash stream ended before tick " << tick << ", nothing left to verify" << std::endl;
+                return;
+            }
+            if (ref_tick != tick || ref_phase != static_cast<uint8_t>(phase)) {
+                throw std::runtime_error("Hash stream is out of sync at tick " + std::to_string(tick));
+            }
+            if (ref_total == h.total) {
+                return;
+            }
+
+            std::ostringstream msg;
+            msg << "Replay diverged at tick " << tick << ", phase " << phase_name(phase);
+            size_t x = std::mismatch(ref_rows.begin(), ref_rows.end(), h.rows.begin()).first - ref_rows.begin();
+            size_t y = std::mismatch(ref_cols.begin(), ref_cols.end(), h.cols.begin()).first - ref_cols.begin();
+            if (x < ref_rows.size() && y < ref_cols.size()) {
+                msg << ", cell (" << x << ", " << y << ")";
+            } else {
+                msg << ", cell unknown";
+            }
+            throw std::runtime_error(msg.str());
+        }
+
+    private:
+        static constexpr char magic[8] = "FLHASH1";
+
+        bool record;
+        bool finished = false;
+        int N;
+        int M;
+        std::ofstream out;
+        std::ifstream in;
+
+        template<typename T>
+        void write(const T &x) {
+            out.write(reinterpret_cast<const char *>(&x), sizeof(T));
+        }
+
+        template<typename T>
+        void read(T &x) {
+            in.read(reinterpret_cast<char *>(&x), sizeof(T));
+        }
+    };
+}
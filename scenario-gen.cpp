@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "flags-parser.h"
+
+//==============================//
+// Scenario generator           //
+//==============================//
+
+// Writes input files for fluid-simulator: a walled box of the given size with obstacles of the chosen shape
+// families and a layer of fluid. The same options and seed give the same map on every platform
+// (std::mt19937 is fully specified, the distributions of the standard library are not)
+
+namespace {
+    using grid_t = std::vector<std::string>;
+
+    struct generator {
+        std::mt19937 rng;
+
+        explicit generator(unsigned seed) : rng(seed) {}
+
+        // Uniform in [from, to]
+        int range(int from, int to) {
+            if (to <= from) {
+                return from;
+            }
+            return from + int(rng() % unsigned(to - from + 1));
+        }
+    };
+
+    // Shape families, each puts one obstacle into the interior and returns the number of new wall cells
+    int place_shape(grid_t &grid, const std::string &shape, generator &gen) {
+        int n = int(grid.size()), m = int(grid[0].size());
+        int x0, y0, h, w;
+        if (shape == "blocks") {
+            h = gen.range(1, std::max(1, n / 8));
+            w = gen.range(1, std::max(1, m / 8));
+            x0 = gen.range(1, n - 1 - h);
+            y0 = gen.range(1, m - 1 - w);
+        } else if (shape == "pillars") {
+            // Standing on the floor or hanging from the ceiling
+            h = gen.range(std::max(1, (n - 2) / 4), std::max(1, (n - 2) / 2));
+            w = gen.range(1, 2);
+            x0 = gen.range(0, 1) ? 1 : n - 1 - h;
+            y0 = gen.range(1, m - 1 - w);
+        } else if (shape == "shelves") {
+            h = 1;
+            w = gen.range(std::max(1, (m - 2) / 8), std::max(1, (m - 2) / 3));
+            x0 = gen.range(1, n - 2);
+            y0 = gen.range(1, m - 1 - w);
+        } else if (shape == "noise") {
+            h = w = 1;
+            x0 = gen.range(1, n - 2);
+            y0 = gen.range(1, m - 2);
+        } else {
+            throw std::invalid_argument("Unknown shape family: " + shape);
+        }
+
+        int added = 0;
+        for (int x = x0; x < std::min(x0 + h, n - 1); ++x) {
+            for (int y = y0; y < std::min(y0 + w, m - 1); ++y) {
+                if (grid[x][y] != '#') {
+                    grid[x][y] = '#';
+                    ++added;
+                }
+            }
+        }
+        return added;
+    }
+
+    std::vector<std::string> split_list(const std::string &list) {
+        std::vector<std::string> items;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    grid_t generate(int n, int m, double density, const std::vector<std::string> &shapes, double fill,
+                    bool from_top, generator &gen) {
+        grid_t grid(n, std::string(m, ' '));
+        for (int x = 0; x < n; ++x) {
+            for (int y = 0; y < m; ++y) {
+                if (x == 0 || y == 0 || x == n - 1 || y == m - 1) {
+                    grid[x][y] = '#';
+                }
+            }
+        }
+
+        // Obstacles until the requested share of the interior is wall; the attempt cap only matters for
+        // densities the shapes can't reach
+        long long interior = (long long) (n - 2) * (m - 2);
+        long long target = (long long) (density * double(interior));
+        long long walls = 0;
+        for (long long attempt = 0; walls < target && attempt < 64 * interior; ++attempt) {
+            walls += place_shape(grid, shapes[gen.range(0, int(shapes.size()) - 1)], gen);
+        }
+
+        // Fluid as a layer of open cells, from the top (it falls, a dam-break start) or from the bottom
+        long long open = interior - walls;
+        long long fluid = (long long) (fill * double(open));
+        for (int i = 1; i < n - 1 && fluid > 0; ++i) {
+            int x = from_top ? i : n - 1 - i;
+            for (int y = 1; y < m - 1 && fluid > 0; ++y) {
+                if (grid[x][y] == ' ') {
+                    grid[x][y] = '.';
+                    --fluid;
+                }
+            }
+        }
+        return grid;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    parser options_parser(argc, argv);
+
+    int n = std::stoi(options_parser.get_option("--rows"));
+    int m = std::stoi(options_parser.get_option("--cols"));
+    double density = std::stod(options_parser.get_option("--obstacles", "0.05"));
+    auto shapes = split_list(options_parser.get_option("--shapes", "blocks"));
+    double fill = std::stod(options_parser.get_option("--fill", "0.2"));
+    auto fill_from = options_parser.get_option("--fill-from", "top");
+    unsigned seed = std::stoul(options_parser.get_option("--seed", "1"));
+    auto output = options_parser.get_option("--output");
+
+    if (n < 3 || m < 3) {
+        throw std::invalid_argument("The map must be at least 3x3");
+    }
+    if (density < 0 || density >= 1) {
+        throw std::invalid_argument("--obstacles must be in [0, 1)");
+    }
+    if (fill < 0 || fill > 1) {
+        throw std::invalid_argument("--fill must be in [0, 1]");
+    }
+    if (fill_from != "top" && fill_from != "bottom") {
+        throw std::invalid_argument("--fill-from must be top or bottom");
+    }
+    if (shapes.empty()) {
+        throw std::invalid_argument("No shape families given");
+    }
+
+    generator gen(seed);
+    auto grid = generate(n, m, density, shapes, fill, fill_from == "top", gen);
+
+    std::ofstream file(output, std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Can't open file " << output << std::endl;
+        return 1;
+    }
+    file << n << " " << m << " " << 0 << "\n";
+    for (auto &row: grid) {
+        file << row << "\n";
+    }
+    std::cout << "Written " << n << "x" << m << " map to " << output << std::endl;
+    return 0;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#include "fixed.h"
+
+namespace Pepega {
+
+    //==============================//
+    // Read-only state views        //
+    //==============================//
+
+    enum class state_plane {
+        field,
+        p,
+        velocity
+    };
+
+    enum class value_kind {
+        character,
+        floating,
+        fixed
+    };
+
+    // What a plane stores: `size` bytes per value, and for Fixed its total and fractional bits
+    struct value_type {
+        value_kind kind = value_kind::character;
+        int size = 1;
+        int bits = 0;
+        int frac = 0;
+    };
+
+    template<typename T>
+    struct value_description {
+        static constexpr value_type get() {
+            static_assert(std::is_same_v<T, char> || std::is_floating_point_v<T>, "no description for this type");
+            if constexpr (std::is_same_v<T, char>) {
+                return {value_kind::character, 1, 8, 0};
+            } else {
+                return {value_kind::floating, int(sizeof(T)), int(sizeof(T)) * 8, 0};
+            }
+        }
+    };
+
+    template<int N, int K, bool isFast>
+    struct value_description<Fixed<N, K, isFast>> {
+        static constexpr value_type get() {
+            return {value_kind::fixed, int(sizeof(typename Fixed<N, K, isFast>::value_t)), N, K};
+        }
+    };
+
+    template<typename Wide>
+    struct value_description<packed_fixed<Wide>> {
+        static constexpr value_type get() {
+            auto wide = value_description<Wide>::get();
+            wide.size = int(sizeof(typename packed_fixed<Wide>::value_t));
+            return wide;
+        }
+    };
+
+    // A plane as it lies in memory. Cell (x, y) is at data + x * row_stride + y * column_stride, its
+    // components `type.size` bytes apart. With tile != 0 the grid is stored in tile x tile blocks
+    // (see FLUID_TILE) of padded_m / tile blocks per block row, and row_stride only holds inside a block
+    struct plane_view {
+        const void *data = nullptr;
+        int n = 0;
+        int m = 0;
+        ptrdiff_t row_stride = 0;
+        ptrdiff_t column_stride = 0;
+        int components = 1;
+        value_type type{};
+        int tile = 0;
+        int padded_m = 0;
+    };
+
+    struct fluid_stats {
+        int n = 0;
+        int m = 0;
+        int last_active = 0;
+        long long cells = 0;
+        double total_p = 0;
+        double max_velocity = 0;
+    };
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace Pepega {
+
+    //==============================//
+    // Convergence monitoring       //
+    //==============================//
+
+    // What one tick changed, gathered by the recalculation phase and completed after the move phase when
+    // monitoring is on
+    struct tick_sample {
+        // Hash of field, p and velocity before the move phase, which moves nothing in a random-free tick:
+        // the hash of the state after such a tick
+        uint64_t hash = 0;
+        // Largest change of p and of a velocity component over the tick, up to the move phase
+        double p_residual = 0;
+        double v_residual = 0;
+        // No cell had a non-zero move probability, so the tick didn't depend on rnd:
+        // the state after it is a function of the state before it
+        bool random_free = false;
+    };
+
+    enum class steady_kind : uint8_t {
+        none,
+        // The state repeats with `period` ticks (1 is a fixed point) and no tick of the cycle depends on rnd,
+        // so every later tick is known exactly
+        cycle,
+        // Residuals stayed within the tolerance for the whole window; an approximation, rnd still matters
+        settled
+    };
+
+    struct steady_verdict {
+        steady_kind kind = steady_kind::none;
+        int tick = 0;
+        int period = 0;
+    };
+
+    // Watches the samples of consecutive ticks. A cycle of period k is reported once the last k + 1 ticks were
+    // random-free and each of the last k repeated the hash of the tick k before it, so a hash collision would
+    // have to happen k times in a row; a fixed point is also checked by its residuals being exactly zero. The
+    // tick the cycle starts from must be random-free too, its hash is only that of its end state then
+    class steady_monitor {
+        int max_period;
+        double tolerance;
+        int window;
+        std::vector<tick_sample> history;
+        long long seen = 0;
+        int quiet = 0;
+
+        const tick_sample &back(int k) const {
+            return history[size_t((seen - 1 - k) % (long long) history.size())];
+        }
+
+    public:
+        // tolerance 0 only reports exact cycles
+        steady_monitor(int max_period, double tolerance, int window)
+                : max_period(max_period), tolerance(tolerance), window(window), history(2 * max_period + 1) {
+            if (max_period < 1) {
+                throw std::invalid_argument("Steady-state period must be at least 1");
+            }
+            if (tolerance < 0 || window < 1) {
+                throw std::invalid_argument("Steady-state tolerance must be non-negative and the window positive");
+            }
+        }
+
+        steady_verdict observe(int tick, const tick_sample &sample) {
+            history[size_t(seen % (long long) history.size())] = sample;
+            ++seen;
+
+            for (int k = 1; k <= max_period && seen >= 2 * k; ++k) {
+                bool repeats = back(k).random_free;
+                for (int j = 0; j < k && repeats; ++j) {
+                    repeats = back(j).random_free && back(j).hash == back(j + k).hash;
+                }
+                if (repeats && k == 1) {
+                    repeats = sample.p_residual == 0 && sample.v_residual == 0;
+                }
+                if (repeats) {
+                    return {steady_kind::cycle, tick, k};
+                }
+            }
+
+            if (tolerance > 0) {
+                // The first sample has no previous velocity to compare with
+                bool within = seen > 1 && sample.p_residual <= tolerance && sample.v_residual <= tolerance;
+                quiet = within ? quiet + 1 : 0;
+                if (quiet >= window) {
+                    return {steady_kind::settled, tick, 0};
+                }
+            }
+            return {};
+        }
+    };
+}
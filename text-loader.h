@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "missions.h"
+#include "buddies.h"
+
+namespace Pepega {
+
+    //==============================//
+    // Read-only file mapping       //
+    //==============================//
+
+    class mapped_file {
+        const char *data = nullptr;
+        size_t length = 0;
+
+    public:
+        explicit mapped_file(const std::string &path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::invalid_argument("Something went wrong with file opening\n");
+            }
+            struct stat st{};
+            if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+                ::close(fd);
+                throw std::invalid_argument("Something went wrong with file opening\n");
+            }
+            length = st.st_size;
+            void *ptr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (ptr == MAP_FAILED) {
+                throw std::runtime_error("Can't map file " + path);
+            }
+            ::madvise(ptr, length, MADV_SEQUENTIAL);
+            data = static_cast<const char *>(ptr);
+        }
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        ~mapped_file() {
+            ::munmap(const_cast<char *>(data), length);
+        }
+
+        const char *begin() const { return data; }
+
+        const char *end() const { return data + length; }
+    };
+
+    //==============================//
+    // Parallel number parsing      //
+    //==============================//
+
+    inline bool is_text_space(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    // Parses one chunk of whitespace separated numbers. The first pass only counts them, the second one
+    // hands every value to `store` together with its index in the whole file, so chunks can be parsed independently
+    template<typename F>
+    class text_chunk_mission : public Mission {
+        const char *from;
+        const char *to;
+        F *store;
+
+    public:
+        size_t first = 0;
+        size_t limit = 0;
+        size_t count = 0;
+        bool failed = false;
+        bool counting = true;
+
+        text_chunk_mission(const char *from, const char *to, F &store) : from(from), to(to), store(&store) {};
+
+        void do_this() override {
+            const char *ptr = from;
+            size_t k = first;
+            count = 0;
+            while (counting || k < limit) {
+                while (ptr < to && is_text_space(*ptr)) {
+                    ++ptr;
+                }
+                if (ptr == to) {
+                    break;
+                }
+                double tmp = 0;
+                auto [next, ec] = std::from_chars(ptr, to, tmp);
+                if (ec != std::errc()) {
+                    failed = true;
+                    break;
+                }
+                ptr = next;
+                if (not counting) {
+                    (*store)(k++, tmp);
+                }
+                ++count;
+            }
+        }
+    };
+
+    //==============================//
+    // Text save reader             //
+    //==============================//
+
+    // Reads the saved-position.txt format (header, field, then whitespace separated numbers) from a mapped file.
+    // Numbers are parsed in parallel, split at line boundaries, with the same tokenization as `file >> double`:
+    // values missing after the first malformed token are left at zero, exactly as the stream loader does
+    class text_save_reader {
+        mapped_file file;
+        const char *pos;
+
+        void skip_spaces() {
+            while (pos < file.end() && is_text_space(*pos)) {
+                ++pos;
+            }
+        }
+
+        int read_int() {
+            skip_spaces();
+            int x = 0;
+            auto [next, ec] = std::from_chars(pos, file.end(), x);
+            if (ec != std::errc()) {
+                throw std::invalid_argument("Broken save header");
+            }
+            pos = next;
+            return x;
+        }
+
+    public:
+        explicit text_save_reader(const std::string &path) : file(path), pos(file.begin()) {}
+
+        std::tuple<int, int, int> header() {
+            int n = read_int();
+            int m = read_int();
+            int ut = read_int();
+            return {n, m, ut};
+        }
+
+        // Field cells are the next n * m characters, line breaks are skipped
+        template<typename F>
+        void read_field(int n, int m, F &&store) {
+            for (int i = 0; i < n; ++i) {
+                for (int j = 0; j < m; ++j) {
+                    while (pos < file.end() && *pos == '\n') {
+                        ++pos;
+                    }
+                    if (pos == file.end()) {
+                        return;
+                    }
+                    store(i, j, *pos++);
+                }
+            }
+        }
+
+        // Parses up to `total` numbers following the field, calls store(index, value) for each of them
+        template<typename F>
+        void read_numbers(BuddiesForeman &workers, int chunks, size_t total, F &store) {
+            size_t bytes = file.end() - pos;
+            chunks = std::max(1, std::min<int>(chunks, bytes / 4096 + 1));
+
+            std::vector<std::unique_ptr<Mission>> tasks;
+            std::vector<text_chunk_mission<F> *> parts;
+            const char *from = pos;
+            for (int i = 1; i <= chunks; ++i) {
+                const char *to = i == chunks ? file.end() : pos + bytes * i / chunks;
+                to = static_cast<const char *>(std::memchr(to, '\n', file.end() - to));
+                to = to == nullptr ? file.end() : to + 1;
+                if (to <= from) {
+                    continue;
+                }
+                auto part = std::make_unique<text_chunk_mission<F>>(from, to, store);
+                parts.push_back(part.get());
+                tasks.push_back(std::move(part));
+                from = to;
+            }
+
+            workers.set(&tasks);
+            workers.wait();
+
+            // Numbers after the first malformed one are never read by the stream loader
+            size_t first = 0;
+            bool failed = false;
+            for (auto part: parts) {
+                part->counting = false;
+                if (failed) {
+                    continue;
+                }
+                part->first = first;
+                part->limit = std::min(total, first + part->count);
+                first += part->count;
+                failed = part->failed;
+            }
+
+            workers.set(&tasks);
+            workers.wait();
+        }
+    };
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Pepega {
+
+    //==============================//
+    // Worker timeline tracing      //
+    //==============================//
+
+    // What the caller and the pool's workers did over time, written as a Chrome trace (chrome://tracing,
+    // ui.perfetto.dev). Lane 0 is the thread that runs the tick, lane i + 1 worker i. Each lane is written by
+    // its own thread only, into a buffer allocated up front: recording takes no lock and never allocates, and
+    // events past the capacity are counted and dropped
+    class worker_trace {
+        struct event {
+            // A string literal, events keep only the pointer
+            const char *name;
+            uint64_t begin;
+            uint64_t end;
+            int arg;
+        };
+
+        // A cache line each, the workers bump their sizes at the same time
+        struct alignas(64) lane {
+            std::vector<event> events;
+            uint64_t dropped = 0;
+        };
+
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        std::vector<lane> lanes;
+        size_t capacity;
+
+    public:
+        worker_trace(int workers, size_t capacity) : lanes(workers + 1), capacity(capacity) {
+            if (capacity < 1) {
+                throw std::invalid_argument("Trace needs room for at least 1 event per thread");
+            }
+            for (auto &l: lanes) {
+                l.events.reserve(capacity);
+            }
+        }
+
+        int workers() const {
+            return int(lanes.size()) - 1;
+        }
+
+        // Nanoseconds since the trace was started
+        uint64_t now() const {
+            return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - origin).count());
+        }
+
+        // arg < 0 is left out of the file
+        void record(int lane_id, const char *name, uint64_t begin, uint64_t end, int arg = -1) {
+            auto &l = lanes[lane_id];
+            if (l.events.size() < capacity) {
+                l.events.push_back({name, begin, end, arg});
+            } else {
+                ++l.dropped;
+            }
+        }
+
+        // Call when no thread records any more
+        void write(const std::string &path) const {
+            std::ofstream out(path, std::ios::trunc);
+            if (!out.is_open()) {
+                throw std::runtime_error("Can't open trace file " + path);
+            }
+            uint64_t dropped = 0;
+            out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+            for (int i = 0; i < int(lanes.size()); ++i) {
+                out << (i ? ",\n" : "") << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << i
+                    << R"(,"args":{"name":")" << (i ? "worker " + std::to_string(i - 1) : std::string("main"))
+                    << "\"}}";
+                dropped += lanes[i].dropped;
+            }
+            out.setf(std::ios::fixed);
+            out.precision(3);
+            for (int i = 0; i < int(lanes.size()); ++i) {
+                for (auto &e: lanes[i].events) {
+                    // Chrome traces count in microseconds
+                    out << ",\n" << R"({"name":")" << e.name << R"(","ph":"X","pid":1,"tid":)" << i
+                        << R"(,"ts":)" << double(e.begin) / 1000 << R"(,"dur":)" << double(e.end - e.begin) / 1000;
+                    if (e.arg >= 0) {
+                        out << R"(,"args":{"chunks":)" << e.arg << "}";
+                    }
+                    out << "}";
+                }
+            }
+            out << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+            if (!out) {
+                throw std::runtime_error("Can't write trace file " + path);
+            }
+        }
+    };
+
+    // Records [construction, destruction) on a lane when a trace is attached
+    class trace_span {
+        worker_trace *trace;
+        int lane_id;
+        const char *name;
+        uint64_t begin = 0;
+
+    public:
+        trace_span(worker_trace *trace, int lane_id, const char *name)
+                : trace(trace), lane_id(lane_id), name(name) {
+            if (trace) {
+                begin = trace->now();
+            }
+        }
+
+        ~trace_span() {
+            if (trace) {
+                trace->record(lane_id, name, begin, trace->now());
+            }
+        }
+
+        trace_span(const trace_span &) = delete;
+        trace_span &operator=(const trace_span &) = delete;
+    };
+}
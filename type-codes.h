@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "fixed.h"
+
+// Value types as integer codes, the form DTYPES lists them in and the simulator types are chosen by
+
+//==============================//
+// Macros for type definitions  //
+//==============================//
+
+#define FLOAT 1
+#define DOUBLE 2
+#define FIXED(n, k) ((n) * 1000 + (k))
+#define FAST_FIXED(n, k) ((n) * 100000 + (k))
+#define BASESIZE(n, m) std::pair<int, int>((n), (m))
+
+namespace Pepega {
+
+    //==============================//
+    // Type determination template  //
+    //==============================//
+
+    // Template struct to determine the type based on an integer value
+    template<int n>
+    struct get_type_inner {
+        using type = std::conditional_t<n == 1, float, std::conditional_t<n == 2, double,
+        std::conditional_t<(n > 100000), Fixed<n / 100000, n % 100000, true>,
+        std::conditional_t<(n > 1000), Fixed<n / 1000, n % 1000>, void>>>>;
+    };
+
+    template<int n>
+    using get_type = get_type_inner<n>::type;
+}
+
+//==================================================//
+// Types given by name                              //
+//==================================================//
+
+bool parse_type(const std::string& typePrefix, const std::string& typeName, int& param1, int& param2) {
+    std::string pattern = typePrefix + "(%d,%d)";
+    return sscanf(typeName.c_str(), pattern.c_str(), &param1, &param2) == 2;
+}
+
+int get_type(const std::string& typeName) {
+    int param1 = 0, param2 = 0;
+    if (parse_type("FIXED", typeName, param1, param2)) {
+        return FIXED(param1, param2);
+    }
+    if (parse_type("FAST_FIXED", typeName, param1, param2)) {
+        return FAST_FIXED(param1, param2);
+    }
+    if (typeName == "DOUBLE") {
+        return DOUBLE;
+    }
+    if (typeName == "FLOAT") {
+        return FLOAT;
+    }
+
+    throw std::invalid_argument("Unknown type: " + typeName);
+}
+
+// The name get_type(name) reads back as `code`
+std::string type_name(int code) {
+    if (code == FLOAT) {
+        return "FLOAT";
+    }
+    if (code == DOUBLE) {
+        return "DOUBLE";
+    }
+    if (code > 100000) {
+        return "FAST_FIXED(" + std::to_string(code / 100000) + "," + std::to_string(code % 100000) + ")";
+    }
+    return "FIXED(" + std::to_string(code / 1000) + "," + std::to_string(code % 1000) + ")";
+}
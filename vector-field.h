@@ -2,10 +2,18 @@
 
 #include <utility>
 #include <ranges>
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "crutches.h"
-#include "fluid.h"
+#include "placement.h"
+#include "plane-file.h"
 
 namespace Pepega {
     template<typename T, int value_N, int value_M>
@@ -16,6 +24,16 @@ namespace Pepega {
 
         void init(int n, int m) {}
 
+        void allocate(int n, int m, bool huge_pages = false) {}
+
+        bool map_file(const std::string &path, int n, int m) { return false; }
+
+        void sync() {}
+
+        void prefetch_rows(int from, int to) {}
+
+        void touch_rows(int from, int to) {}
+
         void clear() {
             std::memset(arr, 0, sizeof(arr));
         }
@@ -33,48 +51,224 @@ namespace Pepega {
         }
     };
 
+    //==============================//
+    // Grid layout                  //
+    //==============================//
+
+#ifndef FLUID_TILE
+#define FLUID_TILE 0
+#endif
+
+    // Side of the square tiles dynamic-size grids are stored in (0 keeps plain rows). Inside a tile the cells
+    // are row-major, so vertical neighbours stay within a few cache lines and a run of grid_tile cells of one row
+    // is contiguous (enough for a whole Batch when y is a multiple of its lane count)
+    constexpr int grid_tile = FLUID_TILE;
+    static_assert(grid_tile == 0 || (grid_tile >= 8 && (grid_tile & (grid_tile - 1)) == 0),
+                  "FLUID_TILE must be 0 or a power of two not less than 8");
+    constexpr int grid_tile_shift = grid_tile == 0 ? 0 : std::countr_zero(unsigned(grid_tile));
+    constexpr int grid_tile_mask = grid_tile - 1;
+
+    // Offset of cell (x, 0) in a tiled grid with tiles_per_row tiles in every tile row
+    constexpr size_t tile_row_base(int x, int tiles_per_row) {
+        return (size_t(x >> grid_tile_shift) * tiles_per_row << (2 * grid_tile_shift)) +
+               (size_t(x & grid_tile_mask) << grid_tile_shift);
+    }
+
+    // Offset of cell (x, y) from cell (x, 0) in a tiled grid
+    constexpr size_t tile_column_offset(int y) {
+        return (size_t(y >> grid_tile_shift) << (2 * grid_tile_shift)) + (y & grid_tile_mask);
+    }
+
+    // Row of a tiled grid, indexed like a plain row
+    template<typename T>
+    struct tiled_row {
+        T *base;
+
+        T &operator[](int y) const {
+            return base[tile_column_offset(y)];
+        }
+    };
+
     template<typename T>
     struct Array<T, -1, -1>{
-        std::vector<std::vector<T>> arr{};
+        T *arr = nullptr;
         int N = 0;
         int M = 0;
+        bool huge = false;
+        plane_mapping file{};
 
-        void init(int n, int m) {
+        Array() = default;
+
+        Array(const Array &) = delete;
+
+        ~Array() {
+            release();
+        }
+
+        // Maps n x m cells without touching them: the pages end up on the node of whoever constructs the rows first
+        void allocate(int n, int m, bool huge_pages = false) {
+            release();
+            N = n;
+            M = m;
+            huge = huge_pages;
+            arr = static_cast<T *>(map_grid(sizeof(T) * size(), huge));
+        }
+
+        // Backs the grid by a plane file instead of anonymous memory, returns true if the file already held
+        // an n x m grid of this type and layout (its cells are then used as they are)
+        bool map_file(const std::string &path, int n, int m) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain data can live in a plane file");
+            release();
             N = n;
             M = m;
+            plane_header header;
+            header.n = n;
+            header.m = m;
+            header.cell_size = sizeof(T);
+            header.tile = grid_tile;
+            file = map_plane(path, header, sizeof(T) * size());
+            arr = static_cast<T *>(file.data());
+            return file.reused;
+        }
+
+        void sync() {
+            sync_plane(file);
+        }
 
-            if constexpr (std::is_copy_constructible_v<T>) {
-                arr.assign(n, std::vector<T>(m, T{}));
+        // Read-ahead hint for a file-backed grid: rows [from, to) will be swept next
+        void prefetch_rows(int from, int to) {
+            if (file.base == nullptr) {
+                return;
+            }
+            from = std::clamp(from, 0, N);
+            to = std::clamp(to, from, N);
+            if constexpr (grid_tile == 0) {
+                prefetch_plane(arr + index(from, 0), arr + index(to, 0));
             } else {
-                arr.resize(n);
-                for (auto &line: arr) {
-                    std::vector<T> tmp(m);
-                    line.swap(tmp);
+                prefetch_plane(arr + index(from & ~grid_tile_mask, 0), arr + index(padded(to), 0));
+            }
+        }
+
+        void touch_rows(int from, int to) {
+            if (file.base != nullptr) {
+                return;
+            }
+            if constexpr (grid_tile == 0) {
+                std::uninitialized_value_construct_n(arr + size_t(from) * M, size_t(to - from) * M);
+            } else {
+                // Padding rows of the last tile row go with the last real row
+                if (to == N) {
+                    to = padded(N);
+                }
+                for (int x = from; x < to; ++x) {
+                    for (int y = 0; y < padded(M); y += grid_tile) {
+                        std::uninitialized_value_construct_n(&(*this)[x][y], grid_tile);
+                    }
                 }
             }
         }
 
+        void init(int n, int m) {
+            allocate(n, m);
+            touch_rows(0, n);
+        }
+
         void clear() {
-            arr = std::vector(N, std::vector<T>(M, T{}));
+            std::fill_n(arr, size(), T{});
         }
 
-        std::vector<T> &operator[](int n) {
-            return arr[n];
+        // Position of cell (x, y) in arr
+        size_t index(int x, int y) const {
+            if constexpr (grid_tile == 0) {
+                return size_t(x) * M + y;
+            } else {
+                return tile_row_base(x, padded(M) >> grid_tile_shift) + tile_column_offset(y);
+            }
+        }
+
+        auto operator[](int n) {
+            if constexpr (grid_tile == 0) {
+                return arr + size_t(n) * M;
+            } else {
+                return tiled_row<T>{arr + tile_row_base(n, padded(M) >> grid_tile_shift)};
+            }
         }
 
         Array &operator=(const Array &other) {
             if (this == &other) {
                 return *this;
             }
-            arr = other.arr;
+            if (N != other.N || M != other.M) {
+                init(other.N, other.M);
+            }
+            std::copy_n(other.arr, size(), arr);
             return *this;
         }
+
+    private:
+        static int padded(int n) {
+            return grid_tile == 0 ? n : (n + grid_tile_mask) & ~grid_tile_mask;
+        }
+
+        size_t size() const {
+            return size_t(padded(N)) * padded(M);
+        }
+
+        void release() {
+            if (arr == nullptr) {
+                return;
+            }
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                std::destroy_n(arr, size());
+            }
+            if (file.base != nullptr) {
+                unmap_plane(file);
+            } else {
+                unmap_grid(arr, sizeof(T) * size(), huge);
+            }
+            arr = nullptr;
+        }
     };
 
+    //==============================//
+    // Compile-time directions      //
+    //==============================//
+
+    // Slot Dir of a VectorField cell holds the component towards deltas[Dir]; the opposite one is Dir ^ 1
+    template<int Dir>
+    constexpr int opposite = Dir ^ 1;
+
+    // Calls f.template operator()<Dir>() for every direction in deltas order, unrolled at compile time
+    template<typename F>
+    constexpr void for_each_dir(F &&f) {
+        [&]<int... Dir>(std::integer_sequence<int, Dir...>) {
+            (f.template operator()<Dir>(), ...);
+        }(std::make_integer_sequence<int, deltas.size()>{});
+    }
+
+    // Same, but stops at the first direction for which f returns true and reports whether it stopped
+    template<typename F>
+    constexpr bool any_dir(F &&f) {
+        return [&]<int... Dir>(std::integer_sequence<int, Dir...>) {
+            return (f.template operator()<Dir>() || ...);
+        }(std::make_integer_sequence<int, deltas.size()>{});
+    }
+
     template<typename T, int N, int M>
     struct VectorField {
         Array<std::array<T, deltas.size()>, N, M> v;
 
+        template<int Dir>
+        T &get(int x, int y) {
+            static_assert(Dir >= 0 && Dir < int(deltas.size()));
+            return v[x][y][Dir];
+        }
+
+        template<int Dir>
+        T &add(int x, int y, T dv) {
+            return get<Dir>(x, y) += dv;
+        }
+
         T &add(int x, int y, int dx, int dy, T dv) {
             return get(x, y, dx, dy) += dv;
         }